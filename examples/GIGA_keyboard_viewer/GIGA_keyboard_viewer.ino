@@ -85,6 +85,9 @@ void setup() {
   keyboard1.attachRawRelease(OnRawRelease);
   keyboard1.attachHIDPress(OnHIDExtrasPress);
   keyboard1.attachHIDRelease(OnHIDExtrasRelease);
+  // Drawing on the TFT is slow, so have the key events queued and call
+  // the callbacks from loop() instead of the USB thread.
+  keyboard1.useEventQueue();
 
   #ifdef TOUCH_CS
     pinMode(TOUCH_CS, OUTPUT);
@@ -111,6 +114,7 @@ void loop() {
 
   // Update the display with
   UpdateActiveDeviceInfo();
+  keyboard1.processEvents();
 }
 
 //=============================================================================
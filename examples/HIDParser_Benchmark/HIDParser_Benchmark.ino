@@ -0,0 +1,97 @@
+//  Time USBHostHIDParser::parse() on a report descriptor with many report
+//  IDs, like the ones multimedia keyboards, tablets and game controllers
+//  use.  Does not need any USB device connected, the descriptor is handed
+//  to the parser with initFromDescriptor().  Runs once with the per field
+//  callbacks and once with hid_input_report() getting each report at once.
+#include <LibPrintf.h>
+#include <USBHostHIDParser.h>
+REDIRECT_STDOUT_TO(Serial)
+
+#define PARSE_COUNT 20000
+
+// Each report ID: a joystick with signed X and Y and 8 buttons,
+// followed by a consumer control with two 16 bit usages.
+#define JOY_REPORT(id) \
+  0x05, 0x01, 0x09, 0x04, 0xA1, 0x01, 0x85, id, \
+  0x09, 0x30, 0x09, 0x31, 0x15, 0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x02, 0x81, 0x02, \
+  0x05, 0x09, 0x19, 0x01, 0x29, 0x08, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02, \
+  0x05, 0x0C, 0x19, 0x00, 0x2A, 0xFF, 0x03, 0x15, 0x00, 0x26, 0xFF, 0x03, 0x75, 0x10, 0x95, 0x02, 0x81, 0x00, \
+  0xC0
+
+#define REPORT_ID_COUNT 12
+#define REPORT_SIZE 8  // report ID + X + Y + buttons + 2 consumer usages
+
+const uint8_t report_descriptor[] = {
+  JOY_REPORT(1), JOY_REPORT(2), JOY_REPORT(3), JOY_REPORT(4),
+  JOY_REPORT(5), JOY_REPORT(6), JOY_REPORT(7), JOY_REPORT(8),
+  JOY_REPORT(9), JOY_REPORT(10), JOY_REPORT(11), JOY_REPORT(12)
+};
+
+class CountingCB : public USBHostHIDParserCB {
+public:
+  void hid_input_begin(uint32_t topusage, uint32_t type, int lgmin, int lgmax) { begin_count++; }
+  void hid_input_data(uint32_t usage, int32_t value) {
+    data_count++;
+    sum += value;
+  }
+  void hid_input_end() { end_count++; }
+  uint32_t begin_count = 0;
+  uint32_t data_count = 0;
+  uint32_t end_count = 0;
+  volatile int32_t sum = 0;
+};
+
+// Same counts, but from the whole report in one call
+class BatchCountingCB : public CountingCB {
+public:
+  void hid_input_report(const HIDFieldValues &report) {
+    data_count += report.count;
+    for (uint16_t i = 0; i < report.count; i++) sum += report.values[i];
+  }
+};
+
+USBHostHIDParser parser;
+CountingCB counter;
+BatchCountingCB batch_counter;
+uint8_t reports[REPORT_ID_COUNT][REPORT_SIZE];
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial && millis() < 5000) {}
+
+  Serial.println("USBHostHIDParser benchmark");
+  if (!parser.initFromDescriptor(report_descriptor, sizeof(report_descriptor))) {
+    Serial.println("initFromDescriptor failed");
+    while (1) {}
+  }
+  printf("Descriptor: %u bytes, %u report IDs, %u fields\n\r", sizeof(report_descriptor),
+         parser.reportIDCount(), parser.fieldCount());
+  printf("Arena: %lu of %u bytes in use, high water %lu\n\r", USBHostHIDParser::arenaUsed(), HID_ARENA_SIZE,
+         USBHostHIDParser::arenaHighWater());
+
+  for (uint8_t id = 0; id < REPORT_ID_COUNT; id++) {
+    reports[id][0] = id + 1;
+    for (uint8_t i = 1; i < REPORT_SIZE; i++) reports[id][i] = id * 16 + i;
+  }
+}
+
+uint32_t benchParse(CountingCB &cb) {
+  parser.attach(&cb);
+  cb.begin_count = cb.data_count = cb.end_count = 0;
+  uint32_t start = micros();
+  for (uint32_t loop_count = 0; loop_count < PARSE_COUNT; loop_count++) {
+    parser.parse(reports[loop_count % REPORT_ID_COUNT], REPORT_SIZE);
+  }
+  return micros() - start;
+}
+
+void loop() {
+  uint32_t elapsed_us = benchParse(counter);
+  printf("Per field: %u reports in %lu us (%lu ns each) begin: %lu data: %lu end: %lu\n\r", PARSE_COUNT, elapsed_us,
+         (elapsed_us * 1000) / PARSE_COUNT, counter.begin_count, counter.data_count, counter.end_count);
+
+  elapsed_us = benchParse(batch_counter);
+  printf("Batch:     %u reports in %lu us (%lu ns each) data: %lu\n\r", PARSE_COUNT, elapsed_us,
+         (elapsed_us * 1000) / PARSE_COUNT, batch_counter.data_count);
+  delay(2000);
+}
@@ -0,0 +1,57 @@
+//  Compare the per byte store_char/read_char path of SaferRingBufferN with
+//  the bulk write/read calls.  Does not need any USB device connected, it
+//  simply pushes 64 byte packets (one full speed bulk packet) through the
+//  same kind of buffer that USBHostSerialDevice uses.  extras/ring_bench
+//  has the same comparison for a PC, with more chunk sizes.
+#include <LibPrintf.h>
+#include <USBHostSerialDevice.h>
+REDIRECT_STDOUT_TO(Serial)
+
+#define PACKET_SIZE 64
+#define PACKET_COUNT 10000
+
+SaferRingBufferN<128> rb;
+uint8_t packet[PACKET_SIZE];
+uint8_t read_buffer[PACKET_SIZE];
+volatile uint32_t checksum = 0;
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial && millis() < 5000) {}
+
+  Serial.println("SaferRingBufferN benchmark");
+  for (uint8_t i = 0; i < PACKET_SIZE; i++) packet[i] = i;
+}
+
+uint32_t benchPerByte() {
+  rb.clear();
+  uint32_t start = micros();
+  for (uint32_t loop_count = 0; loop_count < PACKET_COUNT; loop_count++) {
+    for (int i = 0; i < PACKET_SIZE; i++) rb.store_char(packet[i]);
+    for (int i = 0; i < PACKET_SIZE; i++) read_buffer[i] = rb.read_char();
+    checksum += read_buffer[loop_count & (PACKET_SIZE - 1)];
+  }
+  return micros() - start;
+}
+
+uint32_t benchBulk() {
+  rb.clear();
+  uint32_t start = micros();
+  for (uint32_t loop_count = 0; loop_count < PACKET_COUNT; loop_count++) {
+    rb.write(packet, PACKET_SIZE);
+    rb.read(read_buffer, PACKET_SIZE);
+    checksum += read_buffer[loop_count & (PACKET_SIZE - 1)];
+  }
+  return micros() - start;
+}
+
+void loop() {
+  uint32_t per_byte_us = benchPerByte();
+  uint32_t bulk_us = benchBulk();
+  uint32_t total_bytes = (uint32_t)PACKET_SIZE * PACKET_COUNT;
+
+  printf("Bytes: %lu per byte: %lu us (%lu KB/s) bulk: %lu us (%lu KB/s)\n\r", total_bytes,
+         per_byte_us, (total_bytes * 1000) / (per_byte_us ? per_byte_us : 1),
+         bulk_us, (total_bytes * 1000) / (bulk_us ? bulk_us : 1));
+  delay(2000);
+}
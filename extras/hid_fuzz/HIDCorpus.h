@@ -0,0 +1,168 @@
+/* Copyright 2026 The GIGA_USBHostMBed5_devices Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Report descriptors and sample reports for the HID parser fuzzer and
+// benchmark.  The keyboard, mouse, PS4 and Switch Pro descriptors are the
+// ones those devices send (the PS4 one trimmed to the reports we use).
+// The Wacom, Huion and SpaceNavigator ones are laid out the way those
+// devices do it (Push/Pop around units, wide vendor fields, a report ID
+// per axis group) with the vendor parts shortened.
+#ifndef __HIDCORPUS_H__
+#define __HIDCORPUS_H__
+#include <stdint.h>
+
+static const uint8_t corpus_keyboard_desc[] = {
+  0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00, 0x25, 0x01,
+  0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x95, 0x01, 0x75, 0x08, 0x81, 0x01, 0x95, 0x05, 0x75, 0x01,
+  0x05, 0x08, 0x19, 0x01, 0x29, 0x05, 0x91, 0x02, 0x95, 0x01, 0x75, 0x03, 0x91, 0x01, 0x95, 0x06,
+  0x75, 0x08, 0x15, 0x00, 0x25, 0x65, 0x05, 0x07, 0x19, 0x00, 0x29, 0x65, 0x81, 0x00, 0xC0
+};
+static const uint8_t corpus_keyboard_reports[] = {
+  8, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00,
+  8, 0x02, 0x00, 0x04, 0x05, 0x00, 0x00, 0x00, 0x00,
+  8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0
+};
+
+static const uint8_t corpus_mouse_desc[] = {
+  0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x09, 0x01, 0xA1, 0x00, 0x05, 0x09, 0x19, 0x01, 0x29, 0x05,
+  0x15, 0x00, 0x25, 0x01, 0x95, 0x05, 0x75, 0x01, 0x81, 0x02, 0x95, 0x01, 0x75, 0x03, 0x81, 0x01,
+  0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x16, 0x01, 0x80, 0x26, 0xFF, 0x7F, 0x75, 0x10, 0x95, 0x02,
+  0x81, 0x06, 0x09, 0x38, 0x15, 0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x01, 0x81, 0x06, 0x05, 0x0C,
+  0x0A, 0x38, 0x02, 0x95, 0x01, 0x81, 0x06, 0xC0, 0xC0
+};
+static const uint8_t corpus_mouse_reports[] = {
+  7, 0x01, 0x05, 0x00, 0xFB, 0xFF, 0x00, 0x00,
+  7, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00,
+  7, 0x00, 0x10, 0x00, 0x20, 0x00, 0x00, 0xFF,
+  0
+};
+
+static const uint8_t corpus_ps4_desc[] = {
+  0x05, 0x01, 0x09, 0x05, 0xA1, 0x01, 0x85, 0x01, 0x09, 0x30, 0x09, 0x31, 0x09, 0x32, 0x09, 0x35,
+  0x15, 0x00, 0x26, 0xFF, 0x00, 0x75, 0x08, 0x95, 0x04, 0x81, 0x02, 0x09, 0x39, 0x15, 0x00, 0x25,
+  0x07, 0x35, 0x00, 0x46, 0x3B, 0x01, 0x65, 0x14, 0x75, 0x04, 0x95, 0x01, 0x81, 0x42, 0x65, 0x00,
+  0x05, 0x09, 0x19, 0x01, 0x29, 0x0E, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x0E, 0x81, 0x02,
+  0x06, 0x00, 0xFF, 0x09, 0x20, 0x75, 0x06, 0x95, 0x01, 0x15, 0x00, 0x25, 0x7F, 0x81, 0x02, 0x05,
+  0x01, 0x09, 0x33, 0x09, 0x34, 0x15, 0x00, 0x26, 0xFF, 0x00, 0x75, 0x08, 0x95, 0x02, 0x81, 0x02,
+  0x06, 0x00, 0xFF, 0x09, 0x21, 0x95, 0x36, 0x81, 0x02, 0x85, 0x05, 0x09, 0x22, 0x95, 0x1F, 0x91,
+  0x02, 0x85, 0x04, 0x09, 0x23, 0x95, 0x24, 0xB1, 0x02, 0x85, 0x02, 0x09, 0x24, 0x95, 0x24, 0xB1,
+  0x02, 0x85, 0x08, 0x09, 0x25, 0x95, 0x03, 0xB1, 0x02, 0x85, 0x10, 0x09, 0x26, 0x95, 0x04, 0xB1,
+  0x02, 0x85, 0x11, 0x09, 0x27, 0x95, 0x02, 0xB1, 0x02, 0x85, 0x12, 0x06, 0x02, 0xFF, 0x09, 0x21,
+  0x95, 0x0F, 0xB1, 0x02, 0x85, 0x13, 0x09, 0x22, 0x95, 0x16, 0xB1, 0x02, 0xC0
+};
+static const uint8_t corpus_ps4_reports[] = {
+  63, 0x01, 0x80, 0x7F, 0x81, 0x7E, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  63, 0x01, 0x00, 0xFF, 0x40, 0xC0, 0x28, 0x31, 0x04, 0x80, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0
+};
+
+static const uint8_t corpus_switch_pro_desc[] = {
+  0x05, 0x01, 0x15, 0x00, 0x09, 0x04, 0xA1, 0x01, 0x85, 0x30, 0x05, 0x01, 0x05, 0x09, 0x19, 0x01,
+  0x29, 0x0A, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x0A, 0x55, 0x00, 0x65, 0x00, 0x81, 0x02,
+  0x05, 0x09, 0x19, 0x0B, 0x29, 0x0E, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x04, 0x81, 0x02,
+  0x75, 0x01, 0x95, 0x02, 0x81, 0x03, 0x0B, 0x01, 0x00, 0x01, 0x00, 0xA1, 0x00, 0x0B, 0x30, 0x00,
+  0x01, 0x00, 0x0B, 0x31, 0x00, 0x01, 0x00, 0x0B, 0x32, 0x00, 0x01, 0x00, 0x0B, 0x35, 0x00, 0x01,
+  0x00, 0x15, 0x00, 0x27, 0xFF, 0xFF, 0x00, 0x00, 0x75, 0x10, 0x95, 0x04, 0x81, 0x02, 0xC0, 0x0B,
+  0x39, 0x00, 0x01, 0x00, 0x15, 0x00, 0x25, 0x07, 0x35, 0x00, 0x46, 0x3B, 0x01, 0x65, 0x14, 0x75,
+  0x04, 0x95, 0x01, 0x81, 0x02, 0x05, 0x09, 0x19, 0x0F, 0x29, 0x12, 0x15, 0x00, 0x25, 0x01, 0x75,
+  0x01, 0x95, 0x04, 0x81, 0x02, 0x75, 0x08, 0x95, 0x34, 0x81, 0x03, 0x06, 0x00, 0xFF, 0x85, 0x21,
+  0x09, 0x01, 0x75, 0x08, 0x95, 0x3F, 0x81, 0x03, 0x85, 0x81, 0x09, 0x02, 0x75, 0x08, 0x95, 0x3F,
+  0x81, 0x03, 0x85, 0x01, 0x09, 0x03, 0x75, 0x08, 0x95, 0x3F, 0x91, 0x83, 0x85, 0x10, 0x09, 0x04,
+  0x75, 0x08, 0x95, 0x3F, 0x91, 0x83, 0x85, 0x80, 0x09, 0x05, 0x75, 0x08, 0x95, 0x3F, 0x91, 0x83,
+  0x85, 0x82, 0x09, 0x06, 0x75, 0x08, 0x95, 0x3F, 0x91, 0x83, 0xC0
+};
+static const uint8_t corpus_switch_pro_reports[] = {
+  12, 0x30, 0x05, 0x00, 0x00, 0x80, 0x00, 0x80, 0x00, 0x80, 0x00, 0x80, 0x0F,
+  12, 0x30, 0x01, 0x80, 0x00, 0x10, 0x00, 0xF0, 0xFF, 0x80, 0x00, 0x80, 0x02,
+  4, 0x21, 0x01, 0x02, 0x03,
+  0
+};
+
+static const uint8_t corpus_wacom_desc[] = {
+  0x05, 0x0D, 0x09, 0x02, 0xA1, 0x01, 0x85, 0x02, 0x09, 0x20, 0xA1, 0x00, 0x09, 0x42, 0x09, 0x44,
+  0x09, 0x45, 0x09, 0x3C, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x04, 0x81, 0x02, 0x95, 0x01,
+  0x81, 0x03, 0x09, 0x32, 0x81, 0x02, 0x95, 0x02, 0x81, 0x03, 0x05, 0x01, 0x09, 0x30, 0xA4, 0x55,
+  0x0D, 0x65, 0x13, 0x35, 0x00, 0x46, 0x10, 0x27, 0x26, 0xA0, 0x3E, 0x75, 0x10, 0x95, 0x01, 0x81,
+  0x02, 0x09, 0x31, 0x46, 0x70, 0x17, 0x26, 0x40, 0x2E, 0x81, 0x02, 0xB4, 0x05, 0x0D, 0x09, 0x30,
+  0x26, 0xFF, 0x07, 0x75, 0x10, 0x81, 0x02, 0x09, 0x3D, 0x09, 0x3E, 0x15, 0xC0, 0x25, 0x3F, 0x75,
+  0x08, 0x95, 0x02, 0x81, 0x02, 0xC0, 0x06, 0x00, 0xFF, 0x09, 0x01, 0x15, 0x00, 0x26, 0xFF, 0x00,
+  0x75, 0x08, 0x95, 0x01, 0xB1, 0x02, 0x85, 0x03, 0x09, 0x01, 0x95, 0x01, 0xB1, 0x02, 0xC0
+};
+static const uint8_t corpus_wacom_reports[] = {
+  10, 0x02, 0x21, 0x10, 0x27, 0x20, 0x1C, 0x00, 0x02, 0x05, 0xFB,
+  10, 0x02, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  5, 0x02, 0x21, 0x10, 0x27, 0x20,
+  0
+};
+
+static const uint8_t corpus_huion_desc[] = {
+  0x06, 0x00, 0xFF, 0x09, 0x01, 0xA1, 0x01, 0x85, 0x08, 0x75, 0x58, 0x95, 0x01, 0x09, 0x01, 0x81,
+  0x02, 0xC0, 0x05, 0x0D, 0x09, 0x02, 0xA1, 0x01, 0x85, 0x0A, 0x09, 0x20, 0xA1, 0x00, 0x09, 0x42,
+  0x09, 0x44, 0x09, 0x45, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x03, 0x81, 0x02, 0x95, 0x03,
+  0x81, 0x03, 0x09, 0x32, 0x95, 0x01, 0x81, 0x02, 0x95, 0x01, 0x81, 0x03, 0x05, 0x01, 0x09, 0x30,
+  0x09, 0x31, 0xA4, 0x55, 0x0D, 0x65, 0x33, 0x27, 0xFF, 0xFF, 0x00, 0x00, 0x75, 0x10, 0x95, 0x02,
+  0x81, 0x02, 0xB4, 0x05, 0x0D, 0x09, 0x30, 0x26, 0xFF, 0x1F, 0x75, 0x10, 0x95, 0x01, 0x81, 0x02,
+  0xC0, 0xC0
+};
+static const uint8_t corpus_huion_reports[] = {
+  12, 0x08, 0x80, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A,
+  8, 0x0A, 0x81, 0x00, 0x10, 0x00, 0x20, 0xFF, 0x0F,
+  0
+};
+
+static const uint8_t corpus_spacenav_desc[] = {
+  0x05, 0x01, 0x09, 0x08, 0xA1, 0x01, 0xA1, 0x00, 0x85, 0x01, 0x16, 0xA2, 0xFE, 0x26, 0x5E, 0x01,
+  0x36, 0x88, 0xFA, 0x46, 0x78, 0x05, 0x55, 0x0C, 0x65, 0x11, 0x09, 0x30, 0x09, 0x31, 0x09, 0x32,
+  0x75, 0x10, 0x95, 0x03, 0x81, 0x06, 0xC0, 0xA1, 0x00, 0x85, 0x02, 0x09, 0x33, 0x09, 0x34, 0x09,
+  0x35, 0x75, 0x10, 0x95, 0x03, 0x81, 0x06, 0xC0, 0xA1, 0x02, 0x85, 0x03, 0x05, 0x01, 0x05, 0x09,
+  0x19, 0x01, 0x29, 0x02, 0x15, 0x00, 0x25, 0x01, 0x35, 0x00, 0x45, 0x01, 0x75, 0x01, 0x95, 0x02,
+  0x81, 0x02, 0x95, 0x0E, 0x81, 0x03, 0xC0, 0xA1, 0x02, 0x85, 0x04, 0x05, 0x08, 0x09, 0x4B, 0x15,
+  0x00, 0x25, 0x01, 0x95, 0x01, 0x75, 0x01, 0x91, 0x02, 0x95, 0x01, 0x75, 0x07, 0x91, 0x03, 0xC0,
+  0x06, 0x00, 0xFF, 0x09, 0x01, 0xA1, 0x02, 0x15, 0x80, 0x25, 0x7F, 0x75, 0x08, 0x09, 0x3A, 0xA1,
+  0x02, 0x85, 0x05, 0x09, 0x20, 0x95, 0x01, 0xB1, 0x02, 0xC0, 0xA1, 0x02, 0x85, 0x06, 0x09, 0x21,
+  0x95, 0x01, 0xB1, 0x02, 0xC0, 0xC0, 0xC0
+};
+static const uint8_t corpus_spacenav_reports[] = {
+  7, 0x01, 0x10, 0x00, 0xF0, 0xFF, 0x5E, 0x01,
+  7, 0x02, 0xA2, 0xFE, 0x00, 0x00, 0x01, 0x00,
+  3, 0x03, 0x02, 0x00,
+  0
+};
+
+typedef struct {
+  const char *name;
+  const uint8_t *descriptor;
+  uint16_t descriptor_length;
+  const uint8_t *reports;  // length byte followed by the report, 0 ends the list
+} hid_corpus_entry_t;
+
+static const hid_corpus_entry_t hid_corpus[] = {
+  {"keyboard", corpus_keyboard_desc, sizeof(corpus_keyboard_desc), corpus_keyboard_reports},
+  {"mouse", corpus_mouse_desc, sizeof(corpus_mouse_desc), corpus_mouse_reports},
+  {"ps4", corpus_ps4_desc, sizeof(corpus_ps4_desc), corpus_ps4_reports},
+  {"switch pro", corpus_switch_pro_desc, sizeof(corpus_switch_pro_desc), corpus_switch_pro_reports},
+  {"wacom", corpus_wacom_desc, sizeof(corpus_wacom_desc), corpus_wacom_reports},
+  {"huion", corpus_huion_desc, sizeof(corpus_huion_desc), corpus_huion_reports},
+  {"spacenav", corpus_spacenav_desc, sizeof(corpus_spacenav_desc), corpus_spacenav_reports},
+};
+
+#endif
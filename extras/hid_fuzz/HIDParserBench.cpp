@@ -0,0 +1,87 @@
+/* Copyright 2026 The GIGA_USBHostMBed5_devices Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Reports per second through USBHostHIDParser::parse() for each device in
+// HIDCorpus.h: with the per field callbacks, with the batch callback, in
+// change only mode, and with every report cut short by one byte.  The
+// numbers are for the host, compare them with each other and between
+// versions of the parser, not with a GIGA.
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+#include "USBHostHIDParser.h"
+#include "HIDCorpus.h"
+
+class PerFieldCB : public USBHostHIDParserCB {
+public:
+  void hid_input_begin(uint32_t topusage, uint32_t type, int lgmin, int lgmax) { sum += topusage; }
+  void hid_input_data(uint32_t usage, int32_t value) { sum += usage + value; }
+  void hid_input_end() { sum++; }
+  uint32_t sum = 0;
+};
+
+class BatchCB : public USBHostHIDParserCB {
+public:
+  void hid_input_report(const HIDFieldValues &report) {
+    for (uint16_t i = 0; i < report.count; i++) sum += report.usages[i] + report.values[i];
+    for (uint16_t i = 0; i < report.bitmask_count; i++) sum += report.bitmasks[i];
+  }
+  uint32_t sum = 0;
+};
+
+static USBHostHIDParser parser;
+
+// Reports per second over the entry's reports, each cut by trim bytes
+static double run(const hid_corpus_entry_t &entry, uint32_t loops, uint8_t trim) {
+  std::vector<std::vector<uint8_t> > reports;
+  for (const uint8_t *r = entry.reports; *r; r += *r + 1) {
+    uint8_t len = (*r > trim) ? *r - trim : 1;
+    reports.push_back(std::vector<uint8_t>(r + 1, r + 1 + len));
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t loop = 0; loop < loops; loop++) {
+    for (auto &report : reports) parser.parse(report.data(), report.size());
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return (double)loops * reports.size() / elapsed.count();
+}
+
+int main(int argc, char **argv) {
+  uint32_t loops = (argc > 1) ? strtoul(argv[1], nullptr, 0) : 200000;
+  PerFieldCB per_field_cb;
+  BatchCB batch_cb;
+
+  printf("%-12s %6s %12s %12s %12s %12s\n", "device", "fields", "per field/s", "batch/s", "changed/s", "short/s");
+  for (const hid_corpus_entry_t &entry : hid_corpus) {
+    if (!parser.initFromDescriptor(entry.descriptor, entry.descriptor_length)) {
+      printf("%-12s descriptor failed\n", entry.name);
+      continue;
+    }
+    parser.setChangeOnly(false);
+    parser.attach(&per_field_cb);
+    double per_field = run(entry, loops, 0);
+    parser.attach(&batch_cb);
+    double batch = run(entry, loops, 0);
+    double shortened = run(entry, loops, 1);
+    parser.setChangeOnly(true);
+    double changed = run(entry, loops, 0);
+    printf("%-12s %6u %12.0f %12.0f %12.0f %12.0f\n", entry.name, parser.fieldCount(), per_field, batch, changed,
+           shortened);
+  }
+  printf("arena high water %u of %u bytes (%u)\n", USBHostHIDParser::arenaHighWater(), HID_ARENA_SIZE,
+         per_field_cb.sum + batch_cb.sum);
+  return 0;
+}
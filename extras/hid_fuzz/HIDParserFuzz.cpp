@@ -0,0 +1,231 @@
+/* Copyright 2026 The GIGA_USBHostMBed5_devices Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Fuzz USBHostHIDParser with random report descriptors and reports.
+//
+// An input is: descriptor length (2 bytes, little endian), the descriptor,
+// then any number of reports each as a length byte followed by the report.
+// A report length byte with the top bit set instead toggles change only
+// mode.  Every input also builds each Output and Feature report the
+// descriptor has.
+//
+// Runs of buttons are checked against the report itself: the default
+// hid_input_report has to call hid_input_data for every button, or in
+// change only mode for the ones that changed, as it would for separate
+// 1 bit fields.
+//
+// Built with -DHID_FUZZ_LIBFUZZER this is a libFuzzer target, otherwise it
+// has its own main() that mutates HIDCorpus.h for a number of iterations.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <vector>
+#include "USBHostHIDParser.h"
+#include "HIDCorpus.h"
+
+static USBHostHIDParser parser;
+
+class FuzzCB : public USBHostHIDParserCB {
+public:
+  void hid_input_report(const HIDFieldValues &report) {
+    // Touch everything parse() handed out so ASan sees any overrun
+    for (uint16_t i = 0; i < report.count; i++) sum += report.usages[i] + report.values[i] + report.field_index[i];
+    for (uint16_t i = 0; i < report.bitmask_count; i++) {
+      sum += report.bitmasks[i] + report.bitmask_changed[i] + report.bitmask_field_index[i];
+    }
+    for (uint16_t i = 0; i < report.length; i++) sum += report.data[i];
+    calls.clear();
+    USBHostHIDParserCB::hid_input_report(report);
+    checkButtons(report);
+  }
+  void hid_input_begin(uint32_t topusage, uint32_t type, int lgmin, int lgmax) { sum += topusage + type + lgmin + lgmax; }
+  void hid_input_data(uint32_t usage, int32_t value) {
+    sum += usage + value;
+    calls.push_back({usage, value});
+  }
+
+  // The buttons hid_input_data should have had, in order, with the values
+  // and the fields before them as the default hid_input_report makes them.
+  void checkButtons(const HIDFieldValues &report) {
+    std::vector<uint32_t> &prev = prev_buttons[report.report_id];
+    bool first_report = prev.empty();
+    prev.resize(report.field_count);
+    size_t call = 0;
+    uint16_t value = 0;
+    for (uint16_t i = 0; i < report.field_count; i++) {
+      const hid_field_t &f = report.fields[i];
+      if (f.op != HID_FIELD_BITMASK) {
+        while ((value < report.count) && (report.field_index[value] == i)) {
+          value++;
+          call++;
+        }
+        continue;
+      }
+      uint32_t bits = (uint32_t)USBHostHIDParser::fieldValue64(report.data, f);
+      uint32_t changed = (f.size < 32) ? ((1ul << f.size) - 1) : 0xffffffff;
+      if (parser.changeOnly() && !first_report) changed &= bits ^ prev[i];
+      prev[i] = bits;
+      for (uint8_t b = 0; b < f.size; b++) {
+        if (!((changed >> b) & 1)) continue;
+        if ((call >= calls.size()) || (calls[call].usage != f.usage + b) || (calls[call].value != (int32_t)((bits >> b) & 1))) {
+          fprintf(stderr, "button %x of report %u: wrong hid_input_data call %zu\n", f.usage + b, report.report_id, call);
+          abort();
+        }
+        call++;
+      }
+    }
+    if (call != calls.size()) {
+      fprintf(stderr, "report %u: %zu hid_input_data calls, expected %zu\n", report.report_id, calls.size(), call);
+      abort();
+    }
+  }
+
+  struct call_t {
+    uint32_t usage;
+    int32_t value;
+  };
+  std::vector<call_t> calls;
+  std::map<uint8_t, std::vector<uint32_t> > prev_buttons;  // by report ID, reset with the parser's change state
+  uint32_t sum = 0;
+};
+
+static FuzzCB fuzz_cb;
+
+static void buildReports(uint8_t type) {
+  uint8_t buffer[512];
+  for (uint16_t id = 0; id < 256; id++) {
+    uint16_t len = parser.reportLength(type, id);
+    if (!len) continue;
+    if (parser.initReport(type, id, buffer, sizeof(buffer)) == 0) continue;
+    for (uint8_t index = 0; index < 4; index++) {
+      parser.setReportValue(type, id, buffer, 0, 0x7fffffff - index, index);
+      parser.setReportValue(type, id, buffer, 0, -0x7fffffff + index, index);
+    }
+    uint32_t usages[2] = {0, 0x00080001};
+    int32_t values[2] = {1, 1};
+    parser.buildReport(type, id, usages, values, 2, buffer, sizeof(buffer));
+  }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  if (size < 2) return 0;
+  uint16_t desc_len = data[0] | (data[1] << 8);
+  data += 2;
+  size -= 2;
+  if (desc_len > size) desc_len = size;
+
+  parser.attach(&fuzz_cb);
+  parser.setChangeOnly(false);
+  fuzz_cb.prev_buttons.clear();
+  if (!parser.initFromDescriptor(data, desc_len)) return 0;
+  data += desc_len;
+  size -= desc_len;
+
+  // Reports are copied so ASan catches reads past the length parse() was given
+  std::vector<uint8_t> report;
+  while (size) {
+    uint8_t len = *data++;
+    size--;
+    if (len & 0x80) {
+      parser.setChangeOnly(!parser.changeOnly());
+      fuzz_cb.prev_buttons.clear();
+      continue;
+    }
+    if (len > size) len = size;
+    report.assign(data, data + len);
+    parser.parse(report.data(), len);
+    data += len;
+    size -= len;
+  }
+  buildReports(HID_REPORT_OUTPUT);
+  buildReports(HID_REPORT_FEATURE);
+  return 0;
+}
+
+#ifndef HID_FUZZ_LIBFUZZER
+// Make a fuzzer input out of a corpus entry
+static void corpusInput(const hid_corpus_entry_t &entry, std::vector<uint8_t> &input) {
+  input.clear();
+  input.push_back(entry.descriptor_length & 0xff);
+  input.push_back(entry.descriptor_length >> 8);
+  input.insert(input.end(), entry.descriptor, entry.descriptor + entry.descriptor_length);
+  for (const uint8_t *r = entry.reports; *r; r += *r + 1) {
+    input.insert(input.end(), r, r + *r + 1);
+  }
+  input.push_back(0x80);  // and again in change only mode
+  for (const uint8_t *r = entry.reports; *r; r += *r + 1) {
+    input.insert(input.end(), r, r + *r + 1);
+  }
+}
+
+static void mutate(std::vector<uint8_t> &input) {
+  uint32_t count = 1 + rand() % 8;
+  while (count--) {
+    size_t pos = input.size() ? rand() % input.size() : 0;
+    switch (rand() % 6) {
+      case 0:  // flip a bit
+        if (input.size()) input[pos] ^= 1 << (rand() % 8);
+        break;
+      case 1:  // random byte
+        if (input.size()) input[pos] = rand();
+        break;
+      case 2:  // interesting byte
+        if (input.size()) {
+          static const uint8_t interesting[] = {0x00, 0x01, 0x7f, 0x80, 0xff, 0x3f, 0x40, 0x20};
+          input[pos] = interesting[rand() % sizeof(interesting)];
+        }
+        break;
+      case 3:  // insert
+        input.insert(input.begin() + pos, (uint8_t)rand());
+        break;
+      case 4:  // delete
+        if (input.size()) input.erase(input.begin() + pos);
+        break;
+      case 5:  // duplicate a run, repeats items and reports
+        if (input.size()) {
+          size_t len = 1 + rand() % 16;
+          if (pos + len > input.size()) len = input.size() - pos;
+          std::vector<uint8_t> run(input.begin() + pos, input.begin() + pos + len);
+          input.insert(input.begin() + pos, run.begin(), run.end());
+        }
+        break;
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  uint32_t iterations = (argc > 1) ? strtoul(argv[1], nullptr, 0) : 100000;
+  unsigned seed = (argc > 2) ? strtoul(argv[2], nullptr, 0) : 1;
+  srand(seed);
+
+  const size_t corpus_count = sizeof(hid_corpus) / sizeof(hid_corpus[0]);
+  std::vector<uint8_t> input;
+  for (size_t i = 0; i < corpus_count; i++) {
+    corpusInput(hid_corpus[i], input);
+    LLVMFuzzerTestOneInput(input.data(), input.size());
+    printf("%s: %u fields %u report IDs\n", hid_corpus[i].name, parser.fieldCount(), parser.reportIDCount());
+  }
+
+  for (uint32_t iteration = 0; iteration < iterations; iteration++) {
+    corpusInput(hid_corpus[rand() % corpus_count], input);
+    mutate(input);
+    LLVMFuzzerTestOneInput(input.data(), input.size());
+    if ((iteration % 10000) == 9999) printf("%u iterations\n", iteration + 1);
+  }
+  printf("done, seed %u\n", seed);
+  return 0;
+}
+#endif
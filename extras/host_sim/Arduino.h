@@ -0,0 +1,94 @@
+/* Host simulation stand-in for the Arduino core API used by the drivers.
+ * Serial writes to stdout; micros()/millis() run off the virtual clock
+ * kept by USBHostSim (see mbed.h).
+ */
+#ifndef __HOST_SIM_ARDUINO_H__
+#define __HOST_SIM_ARDUINO_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+#define LED_BUILTIN 13
+
+uint32_t micros();
+uint32_t millis();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+inline void pinMode(int pin, int mode) {}
+inline void digitalWrite(int pin, int val) {}
+inline int digitalRead(int pin) { return LOW; }
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  size_t write(const char *str) { return str ? write((const uint8_t *)str, strlen(str)) : 0; }
+  virtual int availableForWrite() { return 0; }
+  virtual void flush() {}
+
+  size_t print(const char *str) { return write(str); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(int n, int base = DEC) { return print((long)n, base); }
+  size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+  size_t print(double n, int digits = 2);
+
+  size_t println() { return write("\r\n"); }
+  template <typename T> size_t println(T v) { size_t n = print(v); return n + println(); }
+  template <typename T> size_t println(T v, int fmt) { size_t n = print(v, fmt); return n + println(); }
+
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  size_t readBytes(uint8_t *buffer, size_t length);
+};
+
+// Serial for the simulation, output goes to stdout, there is never input.
+class HostSimSerial : public Stream {
+public:
+  void begin(uint32_t baud) {}
+  void end() {}
+  size_t write(uint8_t c) { return fwrite(&c, 1, 1, stdout); }
+  size_t write(const uint8_t *buffer, size_t size) { return fwrite(buffer, 1, size, stdout); }
+  using Print::write;
+  int available() { return 0; }
+  int read() { return -1; }
+  int peek() { return -1; }
+  int availableForWrite() { return 4096; }
+  void flush() { fflush(stdout); }
+  operator bool() { return true; }
+};
+
+extern HostSimSerial Serial;
+
+namespace arduino {}
+using namespace arduino;
+
+#endif
@@ -0,0 +1,8 @@
+/* Host simulation stand-in for the Arduino_USBHostMbed5 library header. */
+#ifndef __HOST_SIM_ARDUINO_USBHOSTMBED5_H__
+#define __HOST_SIM_ARDUINO_USBHOSTMBED5_H__
+
+#include <Arduino.h>
+#include "USBHost/USBHost.h"
+
+#endif
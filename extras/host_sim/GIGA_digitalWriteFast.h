@@ -0,0 +1,8 @@
+/* Host simulation stand-in for GIGA_digitalWriteFast. */
+#ifndef __HOST_SIM_GIGA_DIGITALWRITEFAST_H__
+#define __HOST_SIM_GIGA_DIGITALWRITEFAST_H__
+
+inline void digitalWriteFast(int pin, int val) {}
+inline void digitalToggleFast(int pin) {}
+
+#endif
@@ -0,0 +1,4 @@
+/* The drivers include "IUSBEnumeratorEx.h", the file in src is named
+ * IUSBEnumeratorEX.h, which only resolves on case insensitive file systems.
+ */
+#include "../../src/IUSBEnumeratorEX.h"
@@ -0,0 +1,8 @@
+/* Host simulation stand-in for LibPrintf, printf already goes to stdout. */
+#ifndef __HOST_SIM_LIBPRINTF_H__
+#define __HOST_SIM_LIBPRINTF_H__
+
+#include <stdio.h>
+#define REDIRECT_STDOUT_TO(x)
+
+#endif
@@ -0,0 +1,19 @@
+/* Host simulation stand-in for MemoryHexDump. */
+#ifndef __HOST_SIM_MEMORYHEXDUMP_H__
+#define __HOST_SIM_MEMORYHEXDUMP_H__
+
+#include <Arduino.h>
+
+inline void MemoryHexDump(Print &out, const void *address, uint32_t count, bool remove_duplicates,
+                          const char *szTitle = nullptr, uint32_t max_output_lines = (uint32_t)-1,
+                          uint32_t starting_display_addr = (uint32_t)-1) {
+  const uint8_t *p = (const uint8_t *)address;
+  if (szTitle) out.printf("%s\n\r", szTitle);
+  for (uint32_t i = 0; (i < count) && ((i / 16) < max_output_lines); i += 16) {
+    out.printf("%08x -", (unsigned)i);
+    for (uint32_t j = i; (j < i + 16) && (j < count); j++) out.printf(" %02x", p[j]);
+    out.printf("\n\r");
+  }
+}
+
+#endif
@@ -0,0 +1,251 @@
+/* Host simulation stand-in for the mbed USBHost, USBEndpoint and
+ * USBDeviceConnected classes.
+ *
+ * Only the parts the drivers in src/ call are here, with the same
+ * signatures and return values as the mbed versions.  The devices, the
+ * data they return and the record of what the drivers sent are set up and
+ * read back through USBHostSim (USBHostSim.h).
+ */
+#ifndef __HOST_SIM_USBHOST_H__
+#define __HOST_SIM_USBHOST_H__
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include "mbed.h"
+#include "USBHostConf.h"
+
+enum USB_TYPE {
+  USB_TYPE_OK = 0,
+  // completion code
+  USB_TYPE_CRC_ERROR = 1,
+  USB_TYPE_BIT_STUFFING_ERROR = 2,
+  USB_TYPE_DATA_TOGGLE_MISMATCH_ERROR = 3,
+  USB_TYPE_STALL_ERROR = 4,
+  USB_TYPE_DEVICE_NOT_RESPONDING_ERROR = 5,
+  USB_TYPE_PID_CHECK_FAILURE_ERROR = 6,
+  USB_TYPE_UNEXPECTED_PID_ERROR = 7,
+  USB_TYPE_DATA_OVERRUN_ERROR = 8,
+  USB_TYPE_DATA_UNDERRUN_ERROR = 9,
+  USB_TYPE_BUFFER_OVERRUN_ERROR = 12,
+  USB_TYPE_BUFFER_UNDERRUN_ERROR = 13,
+  // general usb state
+  USB_TYPE_DISCONNECTED = 14,
+  USB_TYPE_FREE = 15,
+  USB_TYPE_IDLE = 16,
+  USB_TYPE_PROCESSING = 17,
+  USB_TYPE_ERROR = 18
+};
+
+enum ENDPOINT_DIRECTION {
+  OUT = 1,
+  IN
+};
+
+enum ENDPOINT_TYPE {
+  CONTROL_ENDPOINT = 0,
+  ISOCHRONOUS_ENDPOINT,
+  BULK_ENDPOINT,
+  INTERRUPT_ENDPOINT
+};
+
+// Descriptor types
+#define DEVICE_DESCRIPTOR 1
+#define CONFIGURATION_DESCRIPTOR 2
+#define INTERFACE_DESCRIPTOR 4
+#define ENDPOINT_DESCRIPTOR 5
+#define HID_DESCRIPTOR 0x21
+#define HID_REPORT_DESCRIPTOR 0x22
+
+#define DEVICE_DESCRIPTOR_LENGTH 0x12
+#define CONFIGURATION_DESCRIPTOR_LENGTH 0x09
+
+// Class codes
+#define HUB_CLASS 0x09
+#define HID_CLASS 0x03
+#define MSD_CLASS 0x08
+#define SERIAL_CLASS 0x0A
+
+// bmRequestType
+#define USB_HOST_TO_DEVICE 0x00
+#define USB_DEVICE_TO_HOST 0x80
+#define USB_REQUEST_TYPE_STANDARD 0x00
+#define USB_REQUEST_TYPE_CLASS 0x20
+#define USB_REQUEST_TYPE_VENDOR 0x40
+#define USB_RECIPIENT_DEVICE 0x00
+#define USB_RECIPIENT_INTERFACE 0x01
+#define USB_RECIPIENT_ENDPOINT 0x02
+
+// Standard requests
+#define GET_STATUS 0
+#define CLEAR_FEATURE 1
+#define SET_FEATURE 3
+#define SET_ADDRESS 5
+#define GET_DESCRIPTOR 6
+#define SET_DESCRIPTOR 7
+#define GET_CONFIGURATION 8
+#define SET_CONFIGURATION 9
+#define GET_INTERFACE 10
+#define SET_INTERFACE 11
+
+typedef struct __attribute__((packed)) {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint16_t bcdUSB;
+  uint8_t bDeviceClass;
+  uint8_t bDeviceSubClass;
+  uint8_t bDeviceProtocol;
+  uint8_t bMaxPacketSize;
+  uint16_t idVendor;
+  uint16_t idProduct;
+  uint16_t bcdDevice;
+  uint8_t iManufacturer;
+  uint8_t iProduct;
+  uint8_t iSerialNumber;
+  uint8_t bNumConfigurations;
+} DeviceDescriptor;
+
+class USBDeviceConnected;
+class USBHostSim;
+
+class IUSBEnumerator {
+public:
+  virtual ~IUSBEnumerator() {}
+  virtual void setVidPid(uint16_t vid, uint16_t pid) = 0;
+  virtual bool parseInterface(uint8_t intf_nb, uint8_t intf_class, uint8_t intf_subclass, uint8_t intf_protocol) = 0;  //Must return true if the interface should be parsed
+  virtual bool useEndpoint(uint8_t intf_nb, ENDPOINT_TYPE type, ENDPOINT_DIRECTION dir) = 0;                           //Must return true if the endpoint will be used
+};
+
+class USBEndpoint {
+public:
+  USBEndpoint(USBDeviceConnected *dev, uint8_t intf_nb, ENDPOINT_TYPE type, ENDPOINT_DIRECTION dir,
+              uint32_t size, uint8_t address)
+    : dev_(dev), intf_nb_(intf_nb), type_(type), dir_(dir), size_(size), address_(address) {}
+
+  template <typename T>
+  inline void attach(T *tptr, void (T::*mptr)(void)) {
+    if ((mptr != NULL) && (tptr != NULL)) rx_cb_ = mbed::Callback<void()>(tptr, mptr);
+  }
+  inline void attach(void (*fptr)(void)) {
+    if (fptr != NULL) rx_cb_ = mbed::Callback<void()>(fptr);
+  }
+  inline void call() {
+    if (rx_cb_) rx_cb_();
+  }
+
+  USB_TYPE getState() { return state_; }
+  void setState(USB_TYPE st) { state_ = st; }
+  const char *getStateString();
+  uint32_t getLengthTransferred() { return transferred_; }
+  uint8_t *getBufStart() { return buf_start_; }
+  uint32_t getSize() { return size_; }
+  void setSize(uint32_t size) { size_ = size; }
+  ENDPOINT_TYPE getType() { return type_; }
+  ENDPOINT_DIRECTION getDir() { return dir_; }
+  uint8_t getAddress() { return address_; }
+  uint8_t getIntfNb() { return intf_nb_; }
+  USBDeviceConnected *dev() { return dev_; }
+
+private:
+  friend class USBHost;
+  friend class USBHostSim;
+  USBDeviceConnected *dev_;
+  uint8_t intf_nb_;
+  ENDPOINT_TYPE type_;
+  ENDPOINT_DIRECTION dir_;
+  uint32_t size_;
+  uint8_t address_;
+  mbed::Callback<void()> rx_cb_;
+  volatile USB_TYPE state_ = USB_TYPE_FREE;
+  uint8_t *buf_start_ = nullptr;
+  uint32_t buf_len_ = 0;
+  uint32_t transferred_ = 0;
+  bool armed_ = false;  // a transfer is queued and waiting for a completion
+};
+
+class USBDeviceConnected {
+public:
+  uint16_t getVid() { return vid_; }
+  uint16_t getPid() { return pid_; }
+  uint8_t getClass() { return device_class_; }
+  uint8_t getNbIntf() { return nb_intf_; }
+  uint8_t getAddress() { return address_; }
+  bool isEnumerated() { return enumerated_; }
+  void setName(const char *name, uint8_t intf_nb) { names_[intf_nb] = name; }
+  const char *getName(uint8_t intf_nb) { return names_.count(intf_nb) ? names_[intf_nb] : "Unknown"; }
+  USBEndpoint *getEndpoint(uint8_t intf_nb, ENDPOINT_TYPE type, ENDPOINT_DIRECTION dir, uint8_t index = 0);
+
+private:
+  friend class USBHost;
+  friend class USBHostSim;
+  typedef struct {
+    uint8_t bmRequestType;
+    uint8_t bRequest;
+    uint16_t wValue;
+    uint16_t wIndex;
+    USB_TYPE result;
+    std::vector<uint8_t> data;
+    bool used;
+  } control_response_t;
+  control_response_t *findControlResponse(uint8_t requestType, uint8_t request, uint32_t value, uint32_t index);
+
+  uint16_t vid_ = 0;
+  uint16_t pid_ = 0;
+  uint8_t device_class_ = 0;
+  uint8_t nb_intf_ = 0;
+  uint8_t address_ = 0;
+  bool enumerated_ = false;
+  std::map<uint8_t, const char *> names_;
+  std::vector<uint8_t> device_desc_;
+  std::vector<uint8_t> config_desc_;
+  std::map<uint8_t, std::vector<uint8_t>> report_desc_;   // by interface
+  std::map<uint8_t, std::vector<uint8_t>> string_desc_;   // by string index
+  std::vector<control_response_t> control_responses_;
+  std::vector<std::unique_ptr<USBEndpoint>> endpoints_;
+  std::map<uint8_t, std::deque<std::vector<uint8_t>>> in_queue_;  // by endpoint address
+  std::vector<mbed::Callback<void()>> disconnect_cbs_;
+};
+
+class USBHost {
+public:
+  static USBHost *getHostInst();
+
+  USBDeviceConnected *getDevice(uint8_t index);
+  USB_TYPE enumerate(USBDeviceConnected *dev, IUSBEnumerator *pEnumerator);
+
+  template <typename T>
+  inline void registerDriver(USBDeviceConnected *dev, uint8_t intf, T *tptr, void (T::*mptr)(void)) {
+    if ((mptr != NULL) && (tptr != NULL) && dev) dev->disconnect_cbs_.push_back(mbed::Callback<void()>(tptr, mptr));
+  }
+
+  USB_TYPE controlRead(USBDeviceConnected *dev, uint8_t requestType, uint8_t request, uint32_t value, uint32_t index, uint8_t *buf, uint32_t len);
+  USB_TYPE controlWrite(USBDeviceConnected *dev, uint8_t requestType, uint8_t request, uint32_t value, uint32_t index, uint8_t *buf, uint32_t len);
+  USB_TYPE bulkRead(USBDeviceConnected *dev, USBEndpoint *ep, uint8_t *buf, uint32_t len, bool blocking = true);
+  USB_TYPE bulkWrite(USBDeviceConnected *dev, USBEndpoint *ep, uint8_t *buf, uint32_t len, bool blocking = true);
+  USB_TYPE interruptRead(USBDeviceConnected *dev, USBEndpoint *ep, uint8_t *buf, uint32_t len, bool blocking = true);
+  USB_TYPE interruptWrite(USBDeviceConnected *dev, USBEndpoint *ep, uint8_t *buf, uint32_t len, bool blocking = true);
+
+  uint16_t getLengthReportDescr() { return lenReportDescr_; }
+
+  class Lock {
+  public:
+    Lock(USBHost *pHost) : host_(pHost) { host_->usb_mutex_.lock(); }
+    ~Lock() { host_->usb_mutex_.unlock(); }
+  private:
+    USBHost *host_;
+  };
+
+private:
+  friend class USBHostSim;
+  USB_TYPE readTransfer(USBDeviceConnected *dev, USBEndpoint *ep, uint8_t *buf, uint32_t len);
+  USB_TYPE writeTransfer(USBDeviceConnected *dev, USBEndpoint *ep, uint8_t *buf, uint32_t len, bool blocking);
+  std::recursive_mutex usb_mutex_;
+  USBDeviceConnected *slots_[MAX_DEVICE_CONNECTED] = {};
+  std::vector<std::unique_ptr<USBDeviceConnected>> devices_;  // owns attached and detached ones
+  uint16_t lenReportDescr_ = 0;
+};
+
+#endif
@@ -0,0 +1,20 @@
+/* Host simulation stand-in for USBHostConf.h */
+#ifndef __HOST_SIM_USBHOSTCONF_H__
+#define __HOST_SIM_USBHOSTCONF_H__
+
+#define MAX_DEVICE_CONNECTED 5
+#define MAX_HUB_NB 2
+#define MAX_PORT_HUB 7
+#define MAX_INTF 4
+#define MAX_ENDPOINT_PER_INTERFACE 2
+
+//#define DEBUG_USBHOST_SIM
+#ifdef DEBUG_USBHOST_SIM
+#define USB_DBG(x, ...) printf("[USB_DBG: %s:%d]" x "\r\n", __FILE__, __LINE__, ##__VA_ARGS__)
+#define USB_INFO(x, ...) printf("[USB_INFO: %s:%d]" x "\r\n", __FILE__, __LINE__, ##__VA_ARGS__)
+#else
+#define USB_DBG(x, ...)
+#define USB_INFO(x, ...)
+#endif
+
+#endif
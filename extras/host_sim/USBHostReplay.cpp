@@ -0,0 +1,126 @@
+/* Replay of a capture through the host simulation, see USBHostReplay.h */
+#include "USBHostReplay.h"
+
+bool USBHostReplay::load(const char *filename) {
+  FILE *fp = fopen(filename, "rb");
+  if (!fp) return false;
+  std::vector<uint8_t> data;
+  uint8_t buf[4096];
+  size_t cb;
+  while ((cb = fread(buf, 1, sizeof(buf), fp)) > 0) data.insert(data.end(), buf, buf + cb);
+  fclose(fp);
+  return load(data.data(), data.size());
+}
+
+bool USBHostReplay::load(const uint8_t *data, uint32_t len) {
+  trace_.clear();
+  records_.clear();
+  in_records_ = 0;
+  in_bytes_ = 0;
+  control_records_ = 0;
+  if ((len < 4) || memcmp(data, USBHOST_CAPTURE_MAGIC, 4)) return false;
+  trace_.assign(data, data + len);
+
+  uint32_t offset = 4;
+  while ((offset + sizeof(usbhost_capture_record_t)) <= len) {
+    replay_record_t r;
+    memcpy(&r.rec, &trace_[offset], sizeof(r.rec));
+    offset += sizeof(r.rec);
+    memset(&r.setup, 0, sizeof(r.setup));
+    if ((r.rec.type == CAPTURE_CONTROL_READ) || (r.rec.type == CAPTURE_CONTROL_WRITE)) {
+      if ((offset + sizeof(r.setup)) > len) break;
+      memcpy(&r.setup, &trace_[offset], sizeof(r.setup));
+      offset += sizeof(r.setup);
+      control_records_++;
+    } else if (r.rec.type == CAPTURE_IN) {
+      in_records_++;
+      in_bytes_ += r.rec.len;
+    } else if (r.rec.type != CAPTURE_DEVICE) {
+      return false;  // not something we know, the rest can not be trusted
+    }
+    if ((offset + r.rec.len) > len) break;  // truncated capture
+    r.data_offset = offset;
+    offset += r.rec.len;
+    records_.push_back(r);
+  }
+  return true;
+}
+
+USBDeviceConnected *USBHostReplay::deviceFor(uint8_t address) {
+  auto it = devices_.find(address);
+  return (it != devices_.end()) ? it->second : nullptr;
+}
+
+uint32_t USBHostReplay::attachDevices() {
+  devices_.clear();
+  for (auto &r : records_) {
+    const uint8_t *data = &trace_[r.data_offset];
+    if (r.rec.type == CAPTURE_DEVICE) {
+      if (deviceFor(r.rec.dev) || (r.rec.len < DEVICE_DESCRIPTOR_LENGTH)) continue;
+      USBDeviceConnected *dev = USBHostSim::attachDevice(data, data + DEVICE_DESCRIPTOR_LENGTH,
+                                                         r.rec.len - DEVICE_DESCRIPTOR_LENGTH);
+      if (dev) devices_[r.rec.dev] = dev;
+    } else if (r.rec.type == CAPTURE_CONTROL_READ) {
+      USBDeviceConnected *dev = deviceFor(r.rec.dev);
+      if (dev) {
+        USBHostSim::setControlResponse(dev, r.setup.bmRequestType, r.setup.bRequest, r.setup.wValue,
+                                       r.setup.wIndex, data, r.rec.len, (USB_TYPE)r.rec.arg);
+      }
+    } else if (r.rec.type == CAPTURE_CONTROL_WRITE) {
+      USBDeviceConnected *dev = deviceFor(r.rec.dev);
+      if (dev && (r.rec.arg != USB_TYPE_OK)) {
+        USBHostSim::setControlResponse(dev, r.setup.bmRequestType, r.setup.bRequest, r.setup.wValue,
+                                       r.setup.wIndex, nullptr, 0, (USB_TYPE)r.rec.arg);
+      }
+    }
+  }
+  return devices_.size();
+}
+
+uint32_t USBHostReplay::run(bool use_timing, void (*poll)()) {
+  uint32_t count = 0;
+  bool have_time = false;
+  uint32_t last_time = 0;
+  for (auto &r : records_) {
+    if (r.rec.type != CAPTURE_IN) continue;
+    USBDeviceConnected *dev = deviceFor(r.rec.dev);
+    if (!dev) continue;
+    if (use_timing && have_time) USBHostSim::advanceTime(r.rec.time_us - last_time);
+    last_time = r.rec.time_us;
+    have_time = true;
+    USBHostSim::queueIn(dev, r.rec.arg, &trace_[r.data_offset], r.rec.len);
+    count += USBHostSim::process();
+    if (poll) poll();
+  }
+  return count;
+}
+
+uint32_t USBHostReplay::controlMismatches() {
+  uint32_t mismatches = 0;
+  const std::vector<usbsim_control_t> &log = USBHostSim::controlLog();
+  for (auto &dev_map : devices_) {
+    std::vector<const replay_record_t *> expected;
+    for (auto &r : records_) {
+      if ((r.rec.type == CAPTURE_CONTROL_WRITE) && (r.rec.dev == dev_map.first)) expected.push_back(&r);
+    }
+    std::vector<const usbsim_control_t *> actual;
+    for (auto &c : log) {
+      if ((c.dev == dev_map.second) && !(c.bmRequestType & USB_DEVICE_TO_HOST)) actual.push_back(&c);
+    }
+    size_t count = std::max(expected.size(), actual.size());
+    for (size_t i = 0; i < count; i++) {
+      if ((i >= expected.size()) || (i >= actual.size())) {
+        mismatches++;
+        continue;
+      }
+      const replay_record_t *e = expected[i];
+      const usbsim_control_t *a = actual[i];
+      if ((e->setup.bmRequestType != a->bmRequestType) || (e->setup.bRequest != a->bRequest)
+          || (e->setup.wValue != a->wValue) || (e->setup.wIndex != a->wIndex) || (e->rec.len != a->data.size())
+          || (e->rec.len && memcmp(&trace_[e->data_offset], a->data.data(), e->rec.len))) {
+        mismatches++;
+      }
+    }
+  }
+  return mismatches;
+}
@@ -0,0 +1,54 @@
+/* Replay of a capture made with USBHostCapture (src/USBHostCapture.h)
+ * through the host simulation.
+ *
+ * load() reads the capture.  attachDevices() plugs the captured devices
+ * into USBHostSim and scripts the control reads with the captured answers.
+ * Then the program connects its driver and calls run(), which queues the
+ * captured IN packets in order and has USBHostSim deliver them.  Virtual
+ * time follows the captured timestamps, so a replay runs as fast as the
+ * host can go and gives the same result every time.
+ */
+#ifndef __USBHOSTREPLAY_H__
+#define __USBHOSTREPLAY_H__
+
+#include "USBHostSim.h"
+#include "USBHostCapture.h"
+
+class USBHostReplay {
+public:
+  bool load(const char *filename);
+  bool load(const uint8_t *data, uint32_t len);
+
+  // Returns the number of devices attached.
+  uint32_t attachDevices();
+  // Deliver the IN records, returns how many were delivered.  When
+  // use_timing is false virtual time does not move between packets.  poll,
+  // if given, is called after each record, the way loop() would be.
+  uint32_t run(bool use_timing = true, void (*poll)() = nullptr);
+
+  uint32_t devices() { return (uint32_t)devices_.size(); }
+  uint32_t inRecords() { return in_records_; }
+  uint32_t inBytes() { return in_bytes_; }
+  uint32_t controlRecords() { return control_records_; }
+  // Control writes made during the replay that differ from the capture,
+  // in order per device, including ones missing or extra.
+  uint32_t controlMismatches();
+
+private:
+  typedef struct {
+    usbhost_capture_record_t rec;
+    usbhost_capture_setup_t setup;   // control records only
+    uint32_t data_offset;            // into trace_
+  } replay_record_t;
+
+  USBDeviceConnected *deviceFor(uint8_t address);
+
+  std::vector<uint8_t> trace_;
+  std::vector<replay_record_t> records_;
+  std::map<uint8_t, USBDeviceConnected *> devices_;  // captured address -> sim device
+  uint32_t in_records_ = 0;
+  uint32_t in_bytes_ = 0;
+  uint32_t control_records_ = 0;
+};
+
+#endif
@@ -0,0 +1,648 @@
+/* Host simulation of the mbed USBHost stack, see USBHostSim.h.
+ *
+ * Also has the runtime for the Arduino.h and mbed.h stand-ins in this
+ * directory: Serial, the virtual clock, timers and rtos objects.
+ */
+#include <stdarg.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include "USBHostSim.h"
+
+//=============================================================================
+// Virtual clock and timers
+//=============================================================================
+static std::atomic<uint64_t> s_now_us{0};
+static std::recursive_mutex s_timer_mutex;
+static std::vector<mbed::TimerEvent *> s_timers;
+
+static std::vector<usbsim_control_t> s_control_log;
+static std::vector<usbsim_out_t> s_out_log;
+static std::mutex s_log_mutex;
+
+HostSimSerial Serial;
+
+uint32_t micros() { return (uint32_t)s_now_us.load(); }
+uint32_t millis() { return (uint32_t)(s_now_us.load() / 1000); }
+void delay(uint32_t ms) { USBHostSim::advanceTime(ms * 1000); }
+void delayMicroseconds(uint32_t us) { USBHostSim::advanceTime(us); }
+void yield() { std::this_thread::yield(); }
+
+mbed::TimerEvent::TimerEvent() {
+  std::lock_guard<std::recursive_mutex> lock(s_timer_mutex);
+  s_timers.push_back(this);
+}
+
+mbed::TimerEvent::~TimerEvent() {
+  std::lock_guard<std::recursive_mutex> lock(s_timer_mutex);
+  s_timers.erase(std::remove(s_timers.begin(), s_timers.end(), this), s_timers.end());
+}
+
+void mbed::TimerEvent::arm(Callback<void()> cb, std::chrono::microseconds t, bool periodic) {
+  std::lock_guard<std::recursive_mutex> lock(s_timer_mutex);
+  cb_ = cb;
+  due_us_ = s_now_us.load() + t.count();
+  period_us_ = periodic ? ((t.count() > 0) ? t.count() : 1) : 0;
+  armed_ = true;
+}
+
+void mbed::TimerEvent::detach() {
+  std::lock_guard<std::recursive_mutex> lock(s_timer_mutex);
+  armed_ = false;
+}
+
+void mbed::TimerEvent::fireIfDue(uint64_t now_us) {
+  if (!armed_ || (due_us_ > now_us)) return;
+  if (period_us_) due_us_ += period_us_;
+  else armed_ = false;
+  if (cb_) cb_();
+}
+
+void mbed::Timer::start() {
+  if (running_) return;
+  start_us_ = s_now_us.load();
+  running_ = true;
+}
+
+void mbed::Timer::stop() {
+  if (!running_) return;
+  accumulated_us_ += s_now_us.load() - start_us_;
+  running_ = false;
+}
+
+void mbed::Timer::reset() {
+  accumulated_us_ = 0;
+  start_us_ = s_now_us.load();
+}
+
+std::chrono::microseconds mbed::Timer::elapsed_time() const {
+  uint64_t us = accumulated_us_;
+  if (running_) us += s_now_us.load() - start_us_;
+  return std::chrono::microseconds(us);
+}
+
+uint32_t rtos::EventFlags::wait(uint32_t flags, uint32_t millisec, bool clear, bool all) {
+  std::unique_lock<std::mutex> lock(s_.m);
+  auto ready = [&] { return all ? ((flags_ & flags) == flags) : ((flags_ & flags) != 0); };
+  if (millisec == osWaitForever) {
+    s_.wait(lock, ready);
+  } else if (!ready()) {
+    return 0xFFFFFFFEu;  // osFlagsErrorTimeout, time does not pass while we wait
+  }
+  uint32_t ret = flags_;
+  if (clear) flags_ &= ~flags;
+  return ret;
+}
+
+//=============================================================================
+// rtos thread bookkeeping, count of threads that are not blocked.
+//=============================================================================
+static std::atomic<int> s_threads_running{0};
+static thread_local bool s_is_sim_thread = false;
+
+void hostsim::threadStarted() { s_threads_running++; }
+void hostsim::threadEntered() { s_is_sim_thread = true; }
+void hostsim::threadExited() { s_threads_running--; }
+bool hostsim::isSimThread() { return s_is_sim_thread; }
+void hostsim::threadsBlocked(int count) { s_threads_running -= count; }
+void hostsim::threadsWoken(int count) { s_threads_running += count; }
+
+void USBHostSim::waitIdle() {
+  if (s_is_sim_thread) return;
+  while (s_threads_running.load() > 0) std::this_thread::yield();
+}
+
+//=============================================================================
+// Non blocking OUT transfers complete on their own thread, as they would on
+// the USB thread of the GIGA, so a sketch waiting in write() for room in a
+// driver's TX buffer is not waiting on a process() call that never comes.
+// Each queued transfer counts as a running thread until it has completed.
+//=============================================================================
+static std::mutex s_out_mutex;
+static std::condition_variable *s_out_cv = new std::condition_variable;  // OUT thread waits on it at exit
+static std::deque<USBEndpoint *> s_out_queue;
+static uint32_t s_out_generation = 0;  // bumped by reset(), the endpoints are gone
+
+void USBHostSim::outThreadProc() {
+  s_is_sim_thread = true;
+  USBHost *host = USBHost::getHostInst();
+  for (;;) {
+    USBEndpoint *ep;
+    uint32_t generation;
+    {
+      std::unique_lock<std::mutex> lock(s_out_mutex);
+      s_out_cv->wait(lock, [] { return !s_out_queue.empty(); });
+      ep = s_out_queue.front();
+      generation = s_out_generation;
+    }
+    USBHost::Lock lock(host);
+    {
+      // reset() dropped the queue (and counted it) while we waited
+      std::lock_guard<std::mutex> out_lock(s_out_mutex);
+      if (generation != s_out_generation) continue;
+    }
+    if (ep->armed_) {
+      ep->transferred_ = ep->buf_len_;
+      ep->armed_ = false;
+      ep->state_ = USB_TYPE_IDLE;
+      ep->call();
+    }
+    {
+      std::lock_guard<std::mutex> out_lock(s_out_mutex);
+      s_out_queue.pop_front();
+    }
+    s_threads_running--;
+  }
+}
+
+void USBHostSim::queueOut(USBEndpoint *ep) {
+  static std::once_flag started;
+  std::call_once(started, [] { std::thread(outThreadProc).detach(); });
+  std::lock_guard<std::mutex> lock(s_out_mutex);
+  s_threads_running++;
+  s_out_queue.push_back(ep);
+  s_out_cv->notify_one();
+}
+
+void rtos::ThisThread::sleep_for(std::chrono::milliseconds ms) {
+  // From an rtos thread this is only a yield, the main program owns time.
+  if (s_is_sim_thread) std::this_thread::yield();
+  else USBHostSim::advanceTime(ms.count() * 1000);
+}
+
+uint64_t rtos::Kernel::get_ms_count() {
+  return s_now_us.load() / 1000;
+}
+
+//=============================================================================
+// Print
+//=============================================================================
+size_t Print::write(const uint8_t *buffer, size_t size) {
+  size_t n = 0;
+  while (size--) n += write(*buffer++);
+  return n;
+}
+
+size_t Print::print(long n, int base) {
+  if ((base == DEC) && (n < 0)) {
+    size_t cb = print('-');
+    return cb + print((unsigned long)-n, base);
+  }
+  return print((unsigned long)n, base);
+}
+
+size_t Print::print(unsigned long n, int base) {
+  char buf[8 * sizeof(long) + 1];
+  char *str = &buf[sizeof(buf) - 1];
+  *str = '\0';
+  if (base < 2) base = 10;
+  do {
+    unsigned long m = n;
+    n /= base;
+    char c = m - base * n;
+    *--str = c < 10 ? c + '0' : c + 'A' - 10;
+  } while (n);
+  return write(str);
+}
+
+size_t Print::print(double n, int digits) {
+  char buf[48];
+  snprintf(buf, sizeof(buf), "%.*f", digits, n);
+  return write(buf);
+}
+
+size_t Print::printf(const char *format, ...) {
+  char buf[256];
+  va_list ap;
+  va_start(ap, format);
+  int cb = vsnprintf(buf, sizeof(buf), format, ap);
+  va_end(ap);
+  if (cb < 0) return 0;
+  return write((const uint8_t *)buf, ((size_t)cb < sizeof(buf)) ? cb : sizeof(buf) - 1);
+}
+
+size_t Stream::readBytes(uint8_t *buffer, size_t length) {
+  size_t count = 0;
+  while (count < length) {
+    int c = read();
+    if (c < 0) break;
+    *buffer++ = (uint8_t)c;
+    count++;
+  }
+  return count;
+}
+
+//=============================================================================
+// USBEndpoint / USBDeviceConnected
+//=============================================================================
+const char *USBEndpoint::getStateString() {
+  switch (state_) {
+    case USB_TYPE_OK: return "USB_TYPE_OK";
+    case USB_TYPE_STALL_ERROR: return "USB_TYPE_STALL_ERROR";
+    case USB_TYPE_DEVICE_NOT_RESPONDING_ERROR: return "USB_TYPE_DEVICE_NOT_RESPONDING_ERROR";
+    case USB_TYPE_DISCONNECTED: return "USB_TYPE_DISCONNECTED";
+    case USB_TYPE_FREE: return "USB_TYPE_FREE";
+    case USB_TYPE_IDLE: return "USB_TYPE_IDLE";
+    case USB_TYPE_PROCESSING: return "USB_TYPE_PROCESSING";
+    case USB_TYPE_ERROR: return "USB_TYPE_ERROR";
+    default: return "USB_TYPE_???";
+  }
+}
+
+// Answers for the same setup are handed out in the order they were added,
+// the last one is repeated once they are used up.
+USBDeviceConnected::control_response_t *USBDeviceConnected::findControlResponse(uint8_t requestType, uint8_t request,
+    uint32_t value, uint32_t index) {
+  control_response_t *last = nullptr;
+  for (auto &resp : control_responses_) {
+    if ((resp.bmRequestType == requestType) && (resp.bRequest == request) && (resp.wValue == value) && (resp.wIndex == index)) {
+      if (!resp.used) {
+        resp.used = true;
+        return &resp;
+      }
+      last = &resp;
+    }
+  }
+  return last;
+}
+
+USBEndpoint *USBDeviceConnected::getEndpoint(uint8_t intf_nb, ENDPOINT_TYPE type, ENDPOINT_DIRECTION dir, uint8_t index) {
+  for (auto &ep : endpoints_) {
+    if ((ep->getIntfNb() == intf_nb) && (ep->getType() == type) && (ep->getDir() == dir)) {
+      if (index == 0) return ep.get();
+      index--;
+    }
+  }
+  return NULL;
+}
+
+//=============================================================================
+// USBHost
+//=============================================================================
+USBHost *USBHost::getHostInst() {
+  static USBHost host;
+  return &host;
+}
+
+USBDeviceConnected *USBHost::getDevice(uint8_t index) {
+  if (index >= MAX_DEVICE_CONNECTED) return NULL;
+  return slots_[index];
+}
+
+// Walk the configuration descriptor the way the mbed host does, asking the
+// driver about each interface and endpoint.
+USB_TYPE USBHost::enumerate(USBDeviceConnected *dev, IUSBEnumerator *pEnumerator) {
+  Lock lock(this);
+  if (!dev) return USB_TYPE_ERROR;
+  pEnumerator->setVidPid(dev->vid_, dev->pid_);
+
+  const std::vector<uint8_t> &conf = dev->config_desc_;
+  uint32_t index = 0;
+  uint8_t intf_nb = 0;
+  bool parsing_intf = false;
+  while ((index + 1) < conf.size()) {
+    uint8_t len_desc = conf[index];
+    if ((len_desc < 2) || ((index + len_desc) > conf.size())) break;
+    const uint8_t *desc = &conf[index];
+    switch (desc[1]) {
+      case CONFIGURATION_DESCRIPTOR:
+        dev->nb_intf_ = desc[4];
+        break;
+      case INTERFACE_DESCRIPTOR:
+        intf_nb = desc[2];
+        // alternate settings are not selected by the host
+        parsing_intf = (desc[3] == 0) && pEnumerator->parseInterface(intf_nb, desc[5], desc[6], desc[7]);
+        break;
+      case HID_DESCRIPTOR:
+        lenReportDescr_ = desc[7] | (desc[8] << 8);
+        break;
+      case ENDPOINT_DESCRIPTOR:
+        if (parsing_intf) {
+          ENDPOINT_TYPE type = (ENDPOINT_TYPE)(desc[3] & 0x03);
+          ENDPOINT_DIRECTION dir = (desc[2] & 0x80) ? IN : OUT;
+          if (pEnumerator->useEndpoint(intf_nb, type, dir) && !USBHostSim::findEndpoint(dev, desc[2])) {
+            dev->endpoints_.emplace_back(new USBEndpoint(dev, intf_nb, type, dir, desc[4] | (desc[5] << 8), desc[2]));
+          }
+        }
+        break;
+    }
+    index += len_desc;
+  }
+  dev->enumerated_ = true;
+  return USB_TYPE_OK;
+}
+
+static const std::vector<uint8_t> *findDescriptor(uint8_t type, uint8_t desc_index, uint16_t wIndex,
+    const std::vector<uint8_t> &device_desc, const std::vector<uint8_t> &config_desc,
+    const std::map<uint8_t, std::vector<uint8_t>> &report_desc, const std::map<uint8_t, std::vector<uint8_t>> &string_desc) {
+  switch (type) {
+    case DEVICE_DESCRIPTOR: return &device_desc;
+    case CONFIGURATION_DESCRIPTOR: return &config_desc;
+    case 3: {  // string
+      auto it = string_desc.find(desc_index);
+      return (it != string_desc.end()) ? &it->second : nullptr;
+    }
+    case HID_REPORT_DESCRIPTOR: {
+      auto it = report_desc.find((uint8_t)wIndex);
+      return (it != report_desc.end()) ? &it->second : nullptr;
+    }
+  }
+  return nullptr;
+}
+
+USB_TYPE USBHost::controlRead(USBDeviceConnected *dev, uint8_t requestType, uint8_t request, uint32_t value, uint32_t index, uint8_t *buf, uint32_t len) {
+  Lock lock(this);
+  if (!dev) return USB_TYPE_ERROR;
+  USB_TYPE res = USB_TYPE_OK;
+  uint32_t cb = 0;
+  const std::vector<uint8_t> *data = nullptr;
+
+  USBDeviceConnected::control_response_t *resp = dev->findControlResponse(requestType, request, value, index);
+  if (resp) {
+    data = &resp->data;
+    res = resp->result;
+  }
+  if (!data && (request == GET_DESCRIPTOR) && (requestType & USB_DEVICE_TO_HOST)) {
+    data = findDescriptor(value >> 8, value & 0xff, index, dev->device_desc_, dev->config_desc_,
+                          dev->report_desc_, dev->string_desc_);
+    if (!data) res = USB_TYPE_STALL_ERROR;
+  }
+  if (data) {
+    cb = (data->size() < len) ? data->size() : len;
+    if (cb) memcpy(buf, data->data(), cb);
+  } else if (res == USB_TYPE_OK) {
+    // No script for this one, answer with zeros.
+    cb = len;
+    if (buf && len) memset(buf, 0, len);
+  }
+  USBHostSim::logControl(dev, requestType, request, value, index, buf, cb, res);
+  return res;
+}
+
+USB_TYPE USBHost::controlWrite(USBDeviceConnected *dev, uint8_t requestType, uint8_t request, uint32_t value, uint32_t index, uint8_t *buf, uint32_t len) {
+  Lock lock(this);
+  if (!dev) return USB_TYPE_ERROR;
+  USB_TYPE res = USB_TYPE_OK;
+  USBDeviceConnected::control_response_t *resp = dev->findControlResponse(requestType, request, value, index);
+  if (resp) res = resp->result;
+  USBHostSim::logControl(dev, requestType, request, value, index, buf, len, res);
+  return res;
+}
+
+USB_TYPE USBHost::readTransfer(USBDeviceConnected *dev, USBEndpoint *ep, uint8_t *buf, uint32_t len) {
+  Lock lock(this);
+  if (!dev || !ep || (ep->dev_ != dev) || !dev->enumerated_) return USB_TYPE_ERROR;
+  if (ep->armed_) return USB_TYPE_PROCESSING;  // only one transfer per endpoint
+  ep->buf_start_ = buf;
+  ep->buf_len_ = len;
+  ep->transferred_ = 0;
+  ep->armed_ = true;
+  ep->state_ = USB_TYPE_PROCESSING;
+  return USB_TYPE_PROCESSING;
+}
+
+USB_TYPE USBHost::writeTransfer(USBDeviceConnected *dev, USBEndpoint *ep, uint8_t *buf, uint32_t len, bool blocking) {
+  Lock lock(this);
+  if (!dev || !ep || (ep->dev_ != dev) || !dev->enumerated_) return USB_TYPE_ERROR;
+  if (ep->armed_) return USB_TYPE_ERROR;  // previous write still on the bus
+  USBHostSim::logOut(dev, ep->address_, buf, len);
+  ep->buf_start_ = buf;
+  ep->buf_len_ = len;
+  ep->transferred_ = len;
+  if (blocking) {
+    ep->state_ = USB_TYPE_IDLE;
+    return USB_TYPE_OK;
+  }
+  ep->transferred_ = 0;
+  ep->armed_ = true;
+  ep->state_ = USB_TYPE_PROCESSING;
+  USBHostSim::queueOut(ep);
+  return USB_TYPE_PROCESSING;
+}
+
+USB_TYPE USBHost::bulkRead(USBDeviceConnected *dev, USBEndpoint *ep, uint8_t *buf, uint32_t len, bool blocking) {
+  return readTransfer(dev, ep, buf, len);
+}
+
+USB_TYPE USBHost::bulkWrite(USBDeviceConnected *dev, USBEndpoint *ep, uint8_t *buf, uint32_t len, bool blocking) {
+  return writeTransfer(dev, ep, buf, len, blocking);
+}
+
+USB_TYPE USBHost::interruptRead(USBDeviceConnected *dev, USBEndpoint *ep, uint8_t *buf, uint32_t len, bool blocking) {
+  return readTransfer(dev, ep, buf, len);
+}
+
+USB_TYPE USBHost::interruptWrite(USBDeviceConnected *dev, USBEndpoint *ep, uint8_t *buf, uint32_t len, bool blocking) {
+  return writeTransfer(dev, ep, buf, len, blocking);
+}
+
+//=============================================================================
+// USBHostSim
+//=============================================================================
+USBDeviceConnected *USBHostSim::attachDevice(const uint8_t *device_desc, const uint8_t *config_desc, uint16_t config_len) {
+  USBHost *host = USBHost::getHostInst();
+  USBHost::Lock lock(host);
+  for (uint8_t i = 0; i < MAX_DEVICE_CONNECTED; i++) {
+    if (host->slots_[i] == nullptr) {
+      USBDeviceConnected *dev = new USBDeviceConnected;
+      host->devices_.emplace_back(dev);
+      const DeviceDescriptor *dd = (const DeviceDescriptor *)device_desc;
+      dev->device_desc_.assign(device_desc, device_desc + DEVICE_DESCRIPTOR_LENGTH);
+      dev->config_desc_.assign(config_desc, config_desc + config_len);
+      dev->vid_ = dd->idVendor;
+      dev->pid_ = dd->idProduct;
+      dev->device_class_ = dd->bDeviceClass;
+      dev->address_ = i + 1;
+      host->slots_[i] = dev;
+      return dev;
+    }
+  }
+  return nullptr;
+}
+
+void USBHostSim::detachDevice(USBDeviceConnected *dev) {
+  USBHost *host = USBHost::getHostInst();
+  USBHost::Lock lock(host);
+  for (uint8_t i = 0; i < MAX_DEVICE_CONNECTED; i++) {
+    if (host->slots_[i] == dev) host->slots_[i] = nullptr;
+  }
+  for (auto &ep : dev->endpoints_) {
+    ep->armed_ = false;
+    ep->state_ = USB_TYPE_DISCONNECTED;
+  }
+  // Like the mbed host, tell the drivers that registered.  The object
+  // itself stays around in case a driver still holds the pointer.
+  for (auto &cb : dev->disconnect_cbs_) cb();
+  dev->disconnect_cbs_.clear();
+  dev->in_queue_.clear();
+}
+
+void USBHostSim::reset() {
+  USBHost *host = USBHost::getHostInst();
+  USBHost::Lock lock(host);
+  for (uint8_t i = 0; i < MAX_DEVICE_CONNECTED; i++) {
+    if (host->slots_[i]) detachDevice(host->slots_[i]);
+  }
+  {
+    std::lock_guard<std::mutex> out_lock(s_out_mutex);
+    s_threads_running -= (int)s_out_queue.size();
+    s_out_queue.clear();
+    s_out_generation++;
+  }
+  host->devices_.clear();
+  host->lenReportDescr_ = 0;
+  clearLogs();
+  s_now_us = 0;
+}
+
+void USBHostSim::setReportDescriptor(USBDeviceConnected *dev, uint8_t intf_nb, const uint8_t *desc, uint16_t len) {
+  dev->report_desc_[intf_nb].assign(desc, desc + len);
+}
+
+void USBHostSim::setStringDescriptor(USBDeviceConnected *dev, uint8_t index, const char *str) {
+  std::vector<uint8_t> &desc = dev->string_desc_[index];
+  size_t len = strlen(str);
+  if (len > 126) len = 126;
+  desc.resize(2 + len * 2);
+  desc[0] = desc.size();
+  desc[1] = 3;  // string descriptor
+  for (size_t i = 0; i < len; i++) {
+    desc[2 + i * 2] = str[i];
+    desc[3 + i * 2] = 0;
+  }
+}
+
+void USBHostSim::setControlResponse(USBDeviceConnected *dev, uint8_t bmRequestType, uint8_t bRequest,
+                                    uint16_t wValue, uint16_t wIndex, const uint8_t *data, uint16_t len, USB_TYPE result) {
+  USBDeviceConnected::control_response_t resp;
+  resp.bmRequestType = bmRequestType;
+  resp.bRequest = bRequest;
+  resp.wValue = wValue;
+  resp.wIndex = wIndex;
+  resp.result = result;
+  resp.used = false;
+  if (data) resp.data.assign(data, data + len);
+  dev->control_responses_.push_back(resp);
+}
+
+void USBHostSim::queueIn(USBDeviceConnected *dev, uint8_t ep_address, const uint8_t *data, uint32_t len) {
+  USBHost::Lock lock(USBHost::getHostInst());
+  dev->in_queue_[ep_address | 0x80].emplace_back(data, data + len);
+}
+
+uint32_t USBHostSim::pendingIn(USBDeviceConnected *dev, uint8_t ep_address) {
+  USBHost::Lock lock(USBHost::getHostInst());
+  auto it = dev->in_queue_.find(ep_address | 0x80);
+  return (it != dev->in_queue_.end()) ? it->second.size() : 0;
+}
+
+USBEndpoint *USBHostSim::findEndpoint(USBDeviceConnected *dev, uint8_t ep_address) {
+  for (auto &ep : dev->endpoints_) {
+    if (ep->address_ == ep_address) return ep.get();
+  }
+  return nullptr;
+}
+
+uint32_t USBHostSim::process(uint32_t max_completions) {
+  waitIdle();  // OUT completions and driver threads first
+  USBHost *host = USBHost::getHostInst();
+  USBHost::Lock lock(host);
+  uint32_t count = 0;
+  bool progress = true;
+  while (progress && (count < max_completions)) {
+    progress = false;
+    for (uint8_t i = 0; (i < MAX_DEVICE_CONNECTED) && (count < max_completions); i++) {
+      USBDeviceConnected *dev = host->slots_[i];
+      if (!dev) continue;
+      // index loop, a callback may not add endpoints but keep it safe
+      for (size_t e = 0; (e < dev->endpoints_.size()) && (count < max_completions); e++) {
+        USBEndpoint *ep = dev->endpoints_[e].get();
+        // OUT endpoints are completed by the OUT thread
+        if (!ep->armed_ || (ep->dir_ != IN)) continue;
+        auto it = dev->in_queue_.find(ep->address_);
+        if ((it == dev->in_queue_.end()) || it->second.empty()) continue;
+        std::vector<uint8_t> &packet = it->second.front();
+        uint32_t cb = (packet.size() < ep->buf_len_) ? packet.size() : ep->buf_len_;
+        if (cb) memcpy(ep->buf_start_, packet.data(), cb);
+        ep->transferred_ = cb;
+        it->second.pop_front();
+        ep->armed_ = false;
+        ep->state_ = USB_TYPE_IDLE;
+        ep->call();
+        count++;
+        progress = true;
+      }
+    }
+  }
+  return count;
+}
+
+void USBHostSim::advanceTime(uint32_t us) {
+  uint64_t target = s_now_us.load() + us;
+  for (;;) {
+    // fire timers in deadline order, moving the clock to each one and
+    // letting the threads run before looking for the next one.
+    waitIdle();
+    std::lock_guard<std::recursive_mutex> lock(s_timer_mutex);
+    mbed::TimerEvent *next = nullptr;
+    uint64_t next_due = target;
+    for (auto t : s_timers) {
+      uint64_t due;
+      if (t->dueTime(due) && (due <= next_due)) {
+        next = t;
+        next_due = due;
+      }
+    }
+    if (!next) break;
+    if (next_due > s_now_us.load()) s_now_us = next_due;
+    next->fireIfDue(next_due);
+  }
+  s_now_us = target;
+  waitIdle();
+}
+
+uint64_t USBHostSim::now() {
+  return s_now_us.load();
+}
+
+const std::vector<usbsim_control_t> &USBHostSim::controlLog() {
+  waitIdle();
+  return s_control_log;
+}
+
+const std::vector<usbsim_out_t> &USBHostSim::outLog() {
+  waitIdle();
+  return s_out_log;
+}
+
+void USBHostSim::clearLogs() {
+  std::lock_guard<std::mutex> lock(s_log_mutex);
+  s_control_log.clear();
+  s_out_log.clear();
+}
+
+void USBHostSim::logControl(USBDeviceConnected *dev, uint8_t requestType, uint8_t request, uint32_t value,
+                            uint32_t index, const uint8_t *buf, uint32_t len, USB_TYPE result) {
+  std::lock_guard<std::mutex> lock(s_log_mutex);
+  usbsim_control_t entry;
+  entry.time_us = s_now_us.load();
+  entry.dev = dev;
+  entry.bmRequestType = requestType;
+  entry.bRequest = request;
+  entry.wValue = value;
+  entry.wIndex = index;
+  entry.wLength = len;
+  entry.result = result;
+  if (buf && len) entry.data.assign(buf, buf + len);
+  s_control_log.push_back(entry);
+}
+
+void USBHostSim::logOut(USBDeviceConnected *dev, uint8_t address, const uint8_t *buf, uint32_t len) {
+  std::lock_guard<std::mutex> lock(s_log_mutex);
+  usbsim_out_t entry;
+  entry.time_us = s_now_us.load();
+  entry.dev = dev;
+  entry.address = address;
+  if (buf && len) entry.data.assign(buf, buf + len);
+  s_out_log.push_back(entry);
+}
@@ -0,0 +1,88 @@
+/* Host simulation of the mbed USBHost stack, so the drivers in src/ can be
+ * built and run on a workstation.
+ *
+ * A test or benchmark program attaches scripted devices (device and
+ * configuration descriptors, HID report descriptors, strings and canned
+ * control responses), lets the driver connect() as it would on the GIGA,
+ * then queues IN packets and calls process() to deliver them to the
+ * driver's rxHandler.  Everything the driver sends, control transfers and
+ * bulk/interrupt OUT data, is recorded with the virtual time it was sent.
+ *
+ * All IN reads are treated as queued transfers: bulkRead/interruptRead
+ * arm the endpoint and return USB_TYPE_PROCESSING, the completion and the
+ * endpoint callback happen in process().  Non blocking writes complete on
+ * a thread of the simulation, like the USB thread on the GIGA, so a
+ * buffered write() that has to wait for the bus finishes without
+ * process().  Blocking writes complete right away.
+ */
+#ifndef __USBHOSTSIM_H__
+#define __USBHOSTSIM_H__
+
+#include <Arduino.h>
+#include "USBHost/USBHost.h"
+
+typedef struct {
+  uint64_t time_us;
+  USBDeviceConnected *dev;
+  uint8_t bmRequestType;
+  uint8_t bRequest;
+  uint16_t wValue;
+  uint16_t wIndex;
+  uint16_t wLength;
+  USB_TYPE result;
+  std::vector<uint8_t> data;  // data returned (IN) or sent (OUT)
+} usbsim_control_t;
+
+typedef struct {
+  uint64_t time_us;
+  USBDeviceConnected *dev;
+  uint8_t address;            // endpoint address
+  std::vector<uint8_t> data;
+} usbsim_out_t;
+
+class USBHostSim {
+public:
+  // Devices
+  static USBDeviceConnected *attachDevice(const uint8_t *device_desc, const uint8_t *config_desc, uint16_t config_len);
+  static void detachDevice(USBDeviceConnected *dev);
+  static void reset();  // detach everything, clear logs and time
+
+  static void setReportDescriptor(USBDeviceConnected *dev, uint8_t intf_nb, const uint8_t *desc, uint16_t len);
+  static void setStringDescriptor(USBDeviceConnected *dev, uint8_t index, const char *str);
+  // Answer for a control transfer with this setup, both directions. For
+  // controlWrite only the result is used.  Several answers for the same
+  // setup are used in order, the last one repeats.
+  static void setControlResponse(USBDeviceConnected *dev, uint8_t bmRequestType, uint8_t bRequest,
+                                 uint16_t wValue, uint16_t wIndex, const uint8_t *data, uint16_t len,
+                                 USB_TYPE result = USB_TYPE_OK);
+
+  // Completions
+  static void queueIn(USBDeviceConnected *dev, uint8_t ep_address, const uint8_t *data, uint32_t len);
+  static uint32_t pendingIn(USBDeviceConnected *dev, uint8_t ep_address);
+  static USBEndpoint *findEndpoint(USBDeviceConnected *dev, uint8_t ep_address);
+  // Deliver queued IN completions to the drivers, returns how many. Keeps
+  // going while the drivers re-arm and data is waiting.  Waits for the
+  // OUT completions and the rtos threads first.
+  static uint32_t process(uint32_t max_completions = 0xffffffff);
+
+  // Virtual time, fires any Timeout/Ticker that comes due.
+  static void advanceTime(uint32_t us);
+  static uint64_t now();
+  // Wait until every rtos::Thread the drivers started is blocked.
+  static void waitIdle();
+
+  // What the drivers sent, once the OUT completions and threads are idle
+  static const std::vector<usbsim_control_t> &controlLog();
+  static const std::vector<usbsim_out_t> &outLog();
+  static void clearLogs();
+
+private:
+  friend class USBHost;
+  static void logControl(USBDeviceConnected *dev, uint8_t requestType, uint8_t request, uint32_t value,
+                         uint32_t index, const uint8_t *buf, uint32_t len, USB_TYPE result);
+  static void logOut(USBDeviceConnected *dev, uint8_t address, const uint8_t *buf, uint32_t len);
+  static void queueOut(USBEndpoint *ep);  // non blocking OUT, completed by outThreadProc
+  static void outThreadProc();
+};
+
+#endif
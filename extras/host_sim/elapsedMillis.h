@@ -0,0 +1,25 @@
+/* Host simulation stand-in for elapsedMillis, runs off the virtual clock. */
+#ifndef __HOST_SIM_ELAPSEDMILLIS_H__
+#define __HOST_SIM_ELAPSEDMILLIS_H__
+
+#include <Arduino.h>
+
+class elapsedMillis {
+public:
+  elapsedMillis(uint32_t val = 0) { ms_ = millis() - val; }
+  operator uint32_t() const { return millis() - ms_; }
+  elapsedMillis &operator=(uint32_t val) { ms_ = millis() - val; return *this; }
+private:
+  uint32_t ms_;
+};
+
+class elapsedMicros {
+public:
+  elapsedMicros(uint32_t val = 0) { us_ = micros() - val; }
+  operator uint32_t() const { return micros() - us_; }
+  elapsedMicros &operator=(uint32_t val) { us_ = micros() - val; return *this; }
+private:
+  uint32_t us_;
+};
+
+#endif
@@ -0,0 +1,281 @@
+/* Host simulation stand-in for the parts of mbed and rtos used by the drivers.
+ *
+ * Time is virtual: micros()/millis() only move when delay(),
+ * ThisThread::sleep_for() or USBHostSim::advanceTime() are called, and any
+ * Timeout or Ticker that comes due fires from inside that call, the way an
+ * ISR would.  rtos::Thread runs on a std::thread, the sync objects use
+ * std::mutex/condition_variable.  Time is only advanced once all of the
+ * rtos threads are blocked waiting on something.
+ */
+#ifndef __HOST_SIM_MBED_H__
+#define __HOST_SIM_MBED_H__
+
+#include <stdint.h>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+#define MBED_ASSERT(x) ((void)0)
+#define osWaitForever 0xFFFFFFFFu
+
+typedef enum {
+  osPriorityIdle = 1,
+  osPriorityLow = 8,
+  osPriorityBelowNormal = 16,
+  osPriorityNormal = 24,
+  osPriorityNormal1, osPriorityNormal2, osPriorityNormal3,
+  osPriorityAboveNormal = 32,
+  osPriorityHigh = 40,
+  osPriorityRealtime = 48
+} osPriority;
+
+typedef enum {osOK = 0, osEventSignal = 0x08, osEventMessage = 0x10, osEventMail = 0x20, osEventTimeout = 0x40} osStatus;
+
+typedef struct {
+  osStatus status;
+  union {
+    uint32_t v;
+    void *p;
+  } value;
+} osEvent;
+
+namespace mbed {
+
+template <typename F> class Callback;
+
+template <typename R, typename... A>
+class Callback<R(A...)> {
+public:
+  Callback() {}
+  Callback(R (*fn)(A...)) : fn_(fn) {}
+  template <typename T>
+  Callback(T *obj, R (T::*method)(A...)) : fn_([obj, method](A... a) { return (obj->*method)(a...); }) {}
+  R operator()(A... a) const { return fn_(a...); }
+  R call(A... a) const { return fn_(a...); }
+  explicit operator bool() const { return (bool)fn_; }
+private:
+  std::function<R(A...)> fn_;
+};
+
+template <typename R, typename... A>
+Callback<R(A...)> callback(R (*fn)(A...)) { return Callback<R(A...)>(fn); }
+template <typename T, typename R, typename... A>
+Callback<R(A...)> callback(T *obj, R (T::*method)(A...)) { return Callback<R(A...)>(obj, method); }
+
+// One shot and periodic timers, fired by the virtual clock.
+class TimerEvent {
+public:
+  TimerEvent();
+  virtual ~TimerEvent();
+  void detach();
+  // called by the simulated clock
+  bool dueTime(uint64_t &due_us) const { due_us = due_us_; return armed_; }
+  void fireIfDue(uint64_t now_us);
+protected:
+  void arm(Callback<void()> cb, std::chrono::microseconds t, bool periodic);
+  Callback<void()> cb_;
+  uint64_t due_us_ = 0;
+  uint64_t period_us_ = 0;
+  bool armed_ = false;
+};
+
+class Timeout : public TimerEvent {
+public:
+  void attach(Callback<void()> cb, std::chrono::microseconds t) { arm(cb, t, false); }
+};
+
+class Ticker : public TimerEvent {
+public:
+  void attach(Callback<void()> cb, std::chrono::microseconds t) { arm(cb, t, true); }
+};
+
+class Timer {
+public:
+  void start();
+  void stop();
+  void reset();
+  std::chrono::microseconds elapsed_time() const;
+private:
+  uint64_t start_us_ = 0;
+  uint64_t accumulated_us_ = 0;
+  bool running_ = false;
+};
+
+}  // namespace mbed
+
+// Bookkeeping so the virtual clock only moves when every rtos::Thread is
+// blocked, which keeps runs repeatable.  Implemented in USBHostSim.cpp.
+namespace hostsim {
+void threadStarted();
+void threadEntered();
+void threadExited();
+bool isSimThread();
+void threadsBlocked(int count);
+void threadsWoken(int count);
+
+// State for the sync objects.  It is never freed: the objects are often
+// statics and threads are still waiting on them when the program exits.
+struct SyncState {
+  std::mutex m;
+  std::condition_variable cv;
+  int sim_waiters = 0;
+  template <typename Pred> void wait(std::unique_lock<std::mutex> &lock, Pred ready) {
+    while (!ready()) {
+      if (isSimThread()) {
+        sim_waiters++;
+        threadsBlocked(1);
+      }
+      cv.wait(lock);
+    }
+  }
+  void notify() {
+    if (sim_waiters) threadsWoken(sim_waiters);
+    sim_waiters = 0;
+    cv.notify_all();
+  }
+};
+}  // namespace hostsim
+
+namespace rtos {
+
+class Mutex {
+public:
+  void lock() { m_.lock(); }
+  bool trylock() { return m_.try_lock(); }
+  void unlock() { m_.unlock(); }
+private:
+  std::recursive_mutex &m_ = *new std::recursive_mutex;
+};
+
+class Thread {
+public:
+  Thread(osPriority priority = osPriorityNormal, uint32_t stack_size = 0,
+         unsigned char *stack_mem = nullptr, const char *name = nullptr) {}
+  ~Thread() { if (thread_.joinable()) thread_.detach(); }
+  osStatus start(mbed::Callback<void()> task) {
+    hostsim::threadStarted();
+    thread_ = std::thread([task]() { hostsim::threadEntered(); task(); hostsim::threadExited(); });
+    return osOK;
+  }
+  osStatus join() { if (thread_.joinable()) thread_.join(); return osOK; }
+private:
+  std::thread thread_;
+};
+
+class EventFlags {
+public:
+  uint32_t set(uint32_t flags) {
+    std::lock_guard<std::mutex> lock(s_.m);
+    flags_ |= flags;
+    s_.notify();
+    return flags_;
+  }
+  uint32_t clear(uint32_t flags = 0x7fffffff) {
+    std::lock_guard<std::mutex> lock(s_.m);
+    uint32_t prev = flags_;
+    flags_ &= ~flags;
+    return prev;
+  }
+  uint32_t get() const { return flags_; }
+  uint32_t wait_any(uint32_t flags, uint32_t millisec = osWaitForever, bool clear = true) {
+    return wait(flags, millisec, clear, false);
+  }
+  uint32_t wait_all(uint32_t flags, uint32_t millisec = osWaitForever, bool clear = true) {
+    return wait(flags, millisec, clear, true);
+  }
+private:
+  uint32_t wait(uint32_t flags, uint32_t millisec, bool clear, bool all);
+  hostsim::SyncState &s_ = *new hostsim::SyncState;
+  volatile uint32_t flags_ = 0;
+};
+
+class Semaphore {
+public:
+  Semaphore(int32_t count = 0) : count_(count) {}
+  void acquire() {
+    std::unique_lock<std::mutex> lock(s_.m);
+    s_.wait(lock, [this] { return count_ > 0; });
+    count_--;
+  }
+  bool try_acquire() {
+    std::lock_guard<std::mutex> lock(s_.m);
+    if (count_ == 0) return false;
+    count_--;
+    return true;
+  }
+  osStatus release() {
+    std::lock_guard<std::mutex> lock(s_.m);
+    count_++;
+    s_.notify();
+    return osOK;
+  }
+private:
+  hostsim::SyncState &s_ = *new hostsim::SyncState;
+  int32_t count_;
+};
+
+template <typename T, uint32_t queue_sz>
+class Mail {
+public:
+  T *try_alloc() { return alloc(); }
+  T *alloc(uint32_t millisec = 0) {
+    std::lock_guard<std::mutex> lock(s_.m);
+    for (uint32_t i = 0; i < queue_sz; i++) {
+      if (!used_[i]) {
+        used_[i] = true;
+        return &pool_[i];
+      }
+    }
+    return nullptr;
+  }
+  osStatus put(T *mptr) {
+    std::lock_guard<std::mutex> lock(s_.m);
+    queue_.push_back(mptr);
+    s_.notify();
+    return osOK;
+  }
+  osEvent get(uint32_t millisec = osWaitForever) {
+    std::unique_lock<std::mutex> lock(s_.m);
+    osEvent evt;
+    if (millisec == osWaitForever) {
+      s_.wait(lock, [this] { return !queue_.empty(); });
+    } else if (queue_.empty()) {
+      evt.status = osEventTimeout;
+      evt.value.p = nullptr;
+      return evt;
+    }
+    evt.status = osEventMail;
+    evt.value.p = queue_.front();
+    queue_.pop_front();
+    return evt;
+  }
+  T *try_get() {
+    osEvent evt = get(0);
+    return (evt.status == osEventMail) ? (T *)evt.value.p : nullptr;
+  }
+  osStatus free(T *mptr) {
+    std::lock_guard<std::mutex> lock(s_.m);
+    used_[mptr - pool_] = false;
+    return osOK;
+  }
+private:
+  hostsim::SyncState &s_ = *new hostsim::SyncState;
+  std::deque<T *> queue_;
+  T pool_[queue_sz];
+  bool used_[queue_sz] = {};
+};
+
+namespace ThisThread {
+void sleep_for(std::chrono::milliseconds ms);
+}
+
+namespace Kernel {
+uint64_t get_ms_count();
+}
+
+}  // namespace rtos
+
+#endif
@@ -0,0 +1,133 @@
+/* Copyright 2026 The GIGA_USBHostMBed5_devices Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Megabytes per second through SaferRingBufferSpan, the ring buffer
+// USBHostSerialDevice uses for RX and TX, a chunk at a time: one
+// store_char/read_char call per byte, one write/read call per chunk, and
+// writeRegions/readRegions with memcpy and advanceHead/advanceTail the way
+// the serial driver moves USB packets.  Chunk sizes that do not divide the
+// buffer size make the bulk calls wrap.  Every byte read back is checked.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "FasterSafeRingBuffer.h"
+
+using namespace arduino;
+
+enum {PER_BYTE, BULK, REGIONS, MODE_COUNT};
+
+static uint32_t checksum = 0;
+
+static void check(const uint8_t *data, int n, uint8_t &expected) {
+  for (int i = 0; i < n; i++, expected++) {
+    if (data[i] != expected) {
+      fprintf(stderr, "byte %d of a chunk is %02x, expected %02x\n", i, data[i], expected);
+      abort();
+    }
+  }
+}
+
+static void writeChunk(SaferRingBufferSpan &rb, int mode, const uint8_t *chunk, int n) {
+  switch (mode) {
+    case PER_BYTE:
+      for (int i = 0; i < n; i++) rb.store_char(chunk[i]);
+      break;
+    case BULK:
+      rb.write(chunk, n);
+      break;
+    case REGIONS:
+      {
+        ring_regions_t regions;
+        rb.writeRegions(regions);
+        int cb1 = (n < regions.len1) ? n : regions.len1;
+        memcpy(regions.ptr1, chunk, cb1);
+        if (n > cb1) memcpy(regions.ptr2, chunk + cb1, n - cb1);
+        rb.advanceHead(n);
+      }
+      break;
+  }
+}
+
+static void readChunk(SaferRingBufferSpan &rb, int mode, uint8_t *chunk, int n) {
+  switch (mode) {
+    case PER_BYTE:
+      for (int i = 0; i < n; i++) chunk[i] = rb.read_char();
+      break;
+    case BULK:
+      rb.read(chunk, n);
+      break;
+    case REGIONS:
+      {
+        ring_regions_t regions;
+        rb.readRegions(regions);
+        int cb1 = (n < regions.len1) ? n : regions.len1;
+        memcpy(chunk, regions.ptr1, cb1);
+        if (n > cb1) memcpy(chunk + cb1, regions.ptr2, n - cb1);
+        rb.advanceTail(n);
+      }
+      break;
+  }
+}
+
+// Megabytes per second moving total bytes through a buffer of buffer_size
+// bytes, chunk bytes in and then out again
+static double run(uint32_t buffer_size, int chunk, int mode, uint32_t total) {
+  std::vector<uint8_t> storage(buffer_size);
+  SaferRingBufferSpan rb(storage.data(), buffer_size);
+  std::vector<uint8_t> in(chunk), out(chunk);
+  uint8_t next_in = 0, next_out = 0;
+  uint32_t loops = total / chunk;
+
+  // The pattern is only checked once, outside the timing
+  for (int i = 0; i < chunk; i++) in[i] = next_in++;
+  writeChunk(rb, mode, in.data(), chunk);
+  readChunk(rb, mode, out.data(), chunk);
+  check(out.data(), chunk, next_out);
+  if (rb.available() != 0) {
+    fprintf(stderr, "%d bytes left in the buffer\n", rb.available());
+    abort();
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t loop = 0; loop < loops; loop++) {
+    writeChunk(rb, mode, in.data(), chunk);
+    readChunk(rb, mode, out.data(), chunk);
+    checksum += out[loop % chunk];
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return (double)loops * chunk / elapsed.count() / 1e6;
+}
+
+int main(int argc, char **argv) {
+  uint32_t total = (argc > 1) ? strtoul(argv[1], nullptr, 0) : 64 * 1024 * 1024;
+  static const uint32_t buffer_sizes[] = {128, 1024};
+  static const int chunks[] = {1, 8, 63, 64, 100, 128};
+
+  printf("%6s %6s %12s %12s %12s %8s\n", "buffer", "chunk", "per byte", "bulk", "regions", "bulk x");
+  for (uint32_t buffer_size : buffer_sizes) {
+    for (int chunk : chunks) {
+      if ((uint32_t)chunk > buffer_size) continue;
+      double mbs[MODE_COUNT];
+      for (int mode = 0; mode < MODE_COUNT; mode++) mbs[mode] = run(buffer_size, chunk, mode, total);
+      printf("%6u %6d %12.1f %12.1f %12.1f %8.1f\n", buffer_size, chunk, mbs[PER_BYTE], mbs[BULK], mbs[REGIONS],
+             mbs[BULK] / mbs[PER_BYTE]);
+    }
+  }
+  printf("MB/s (%u)\n", checksum);
+  return 0;
+}
@@ -21,6 +21,7 @@
 #ifndef _FASTER_SAFE_RING_BUFFER_
 #define _FASTER_SAFE_RING_BUFFER_
 //#include "sync.h"
+#include <atomic>
 
 
 // Note: Below is a modified version of the RingBuffer.h, that removes the
@@ -36,9 +37,24 @@ namespace arduino {
 
 #define SERIAL_BUFFER_SIZE 64
 
-template <int N>
+// Up to two contiguous pieces of the buffer, the second one is only used
+// when the region wraps around the end of the buffer.
+typedef struct {
+  uint8_t *ptr1;
+  int len1;
+  uint8_t *ptr2;
+  int len2;
+} ring_regions_t;
+
+// Sizes that are a power of two use the specialization below, which uses
+// free running counters and masks instead of modulo math.  Other sizes
+// still work if SAFER_RING_BUFFER_ALLOW_ANY_SIZE is defined.
+template <int N, bool POW2 = ((N > 0) && ((N & (N - 1)) == 0))>
 class SaferRingBufferN
 {
+#ifndef SAFER_RING_BUFFER_ALLOW_ANY_SIZE
+  static_assert(POW2, "SaferRingBufferN: size should be a power of two (or define SAFER_RING_BUFFER_ALLOW_ANY_SIZE)");
+#endif
   public:
     uint8_t _aucBuffer[N] ;
     volatile int _iHead ;
@@ -54,7 +70,25 @@ class SaferRingBufferN
     int peek();
     bool isFull();
 
+    // Bulk versions, move as much as will fit with at most two memcpy calls
+    // and return the number of bytes actually moved.
+    int write(const uint8_t *buffer, int n);
+    int read(uint8_t *buffer, int n);
+
+    // Contiguous regions view.  The producer fills the write regions and
+    // then calls advanceHead, the consumer uses the read regions and then
+    // calls advanceTail.
+    int writeRegions(ring_regions_t &regions);
+    int readRegions(ring_regions_t &regions);
+    void advanceHead(int n);
+    void advanceTail(int n);
+
+    // Number of bytes store_char threw away because the buffer was full.
+    uint32_t overflowCount() const { return _uOverflow; }
+    void clearOverflowCount() { _uOverflow = 0; }
+
   private:
+    volatile uint32_t _uOverflow = 0;
     int nextIndex(int index);
     inline bool isEmpty() const { return (_iHead == _iTail); }
 };
@@ -62,15 +96,15 @@ class SaferRingBufferN
 typedef SaferRingBufferN<SERIAL_BUFFER_SIZE> SaferRingBuffer;
 
 
-template <int N>
-SaferRingBufferN<N>::SaferRingBufferN( void )
+template <int N, bool POW2>
+SaferRingBufferN<N, POW2>::SaferRingBufferN( void )
 {
     memset( _aucBuffer, 0, N ) ;
     clear();
 }
 
-template <int N>
-void SaferRingBufferN<N>::store_char( uint8_t c )
+template <int N, bool POW2>
+void SaferRingBufferN<N, POW2>::store_char( uint8_t c )
 {
   // if we should be storing the received character into the location
   // just before the tail (meaning that the head would advance to the
@@ -81,18 +115,21 @@ void SaferRingBufferN<N>::store_char( uint8_t c )
   {
     _aucBuffer[_iHead] = c ;
     _iHead = newhead;
+  } else {
+    _uOverflow = _uOverflow + 1;
   }
 }
 
-template <int N>
-void SaferRingBufferN<N>::clear()
+template <int N, bool POW2>
+void SaferRingBufferN<N, POW2>::clear()
 {
   _iHead = 0;
   _iTail = 0;
+  _uOverflow = 0;
 }
 
-template <int N>
-int SaferRingBufferN<N>::read_char()
+template <int N, bool POW2>
+int SaferRingBufferN<N, POW2>::read_char()
 {
   if (_iHead == _iTail)
     return -1;
@@ -103,8 +140,8 @@ int SaferRingBufferN<N>::read_char()
   return value;
 }
 
-template <int N>
-int SaferRingBufferN<N>::available()
+template <int N, bool POW2>
+int SaferRingBufferN<N, POW2>::available()
 {
   // grab state of head and tail, to keep result consistent 
   int head = _iHead;
@@ -115,8 +152,8 @@ int SaferRingBufferN<N>::available()
   return N + head - tail;
 }
 
-template <int N>
-int SaferRingBufferN<N>::availableForStore()
+template <int N, bool POW2>
+int SaferRingBufferN<N, POW2>::availableForStore()
 {
   // grab state of head and tail, to keep result consistent 
   int head = _iHead;
@@ -125,8 +162,8 @@ int SaferRingBufferN<N>::availableForStore()
   return tail - head - 1;
 }
 
-template <int N>
-int SaferRingBufferN<N>::peek()
+template <int N, bool POW2>
+int SaferRingBufferN<N, POW2>::peek()
 {
   if (isEmpty())
     return -1;
@@ -134,19 +171,307 @@ int SaferRingBufferN<N>::peek()
   return _aucBuffer[_iTail];
 }
 
-template <int N>
-int SaferRingBufferN<N>::nextIndex(int index)
+template <int N, bool POW2>
+int SaferRingBufferN<N, POW2>::nextIndex(int index)
 {
   return (uint32_t)(index + 1) % N;
 }
 
-template <int N>
-bool SaferRingBufferN<N>::isFull()
+template <int N, bool POW2>
+bool SaferRingBufferN<N, POW2>::isFull()
 {
   int newhead = nextIndex(_iHead);
   return  (newhead == _iTail);
 }
 
+template <int N, bool POW2>
+int SaferRingBufferN<N, POW2>::writeRegions(ring_regions_t &regions)
+{
+  int head = _iHead;
+  int tail = _iTail;
+  regions.ptr1 = &_aucBuffer[head];
+  regions.ptr2 = _aucBuffer;
+  if (head >= tail) {
+    // free space runs to the end of the buffer and then wraps up to tail,
+    // always leaving one slot empty.
+    if (tail == 0) {
+      regions.len1 = N - 1 - head;
+      regions.len2 = 0;
+    } else {
+      regions.len1 = N - head;
+      regions.len2 = tail - 1;
+    }
+  } else {
+    regions.len1 = tail - head - 1;
+    regions.len2 = 0;
+  }
+  return regions.len1 + regions.len2;
+}
+
+template <int N, bool POW2>
+int SaferRingBufferN<N, POW2>::readRegions(ring_regions_t &regions)
+{
+  int head = _iHead;
+  int tail = _iTail;
+  regions.ptr1 = &_aucBuffer[tail];
+  regions.ptr2 = _aucBuffer;
+  if (head >= tail) {
+    regions.len1 = head - tail;
+    regions.len2 = 0;
+  } else {
+    regions.len1 = N - tail;
+    regions.len2 = head;
+  }
+  return regions.len1 + regions.len2;
+}
+
+template <int N, bool POW2>
+void SaferRingBufferN<N, POW2>::advanceHead(int n)
+{
+  int head = _iHead + n;
+  if (head >= N) head -= N;
+  _iHead = head;
+}
+
+template <int N, bool POW2>
+void SaferRingBufferN<N, POW2>::advanceTail(int n)
+{
+  int tail = _iTail + n;
+  if (tail >= N) tail -= N;
+  _iTail = tail;
+}
+
+template <int N, bool POW2>
+int SaferRingBufferN<N, POW2>::write(const uint8_t *buffer, int n)
+{
+  ring_regions_t regions;
+  int cb = writeRegions(regions);
+  if (n < cb) cb = n;
+  if (cb <= 0) return 0;
+
+  int cb1 = (cb < regions.len1) ? cb : regions.len1;
+  memcpy(regions.ptr1, buffer, cb1);
+  if (cb > cb1) memcpy(regions.ptr2, buffer + cb1, cb - cb1);
+  // only publish the new head after the data is in place.
+  advanceHead(cb);
+  return cb;
+}
+
+template <int N, bool POW2>
+int SaferRingBufferN<N, POW2>::read(uint8_t *buffer, int n)
+{
+  ring_regions_t regions;
+  int cb = readRegions(regions);
+  if (n < cb) cb = n;
+  if (cb <= 0) return 0;
+
+  int cb1 = (cb < regions.len1) ? cb : regions.len1;
+  memcpy(buffer, regions.ptr1, cb1);
+  if (cb > cb1) memcpy(buffer + cb1, regions.ptr2, cb - cb1);
+  advanceTail(cb);
+  return cb;
+}
+
+///////////////////////////////////
+// Power of two sizes.  Head and tail are free running counters that are
+// only masked when indexing the buffer, so there is no division, no
+// branches in available() and all of the slots can be used.
+//
+// This version is a proper single producer/single consumer queue: head is
+// only written by the producer (store_char, write, advanceHead) and tail
+// only by the consumer (read_char, read, peek, advanceTail).  Each side
+// publishes its counter with a release store after touching the data and
+// reads the other side's counter with an acquire load, so no mutex or
+// interrupt disabling is needed as long as there is only one of each.
+//
+// SaferRingBufferSpan works on storage supplied by the caller, a size that
+// is not a power of two is rounded down.  SaferRingBufferN<N> for power of
+// two N is the same thing with the storage built in.
+class SaferRingBufferSpan
+{
+  public:
+    uint8_t *_aucBuffer ;
+    std::atomic<uint32_t> _uHead ;
+    std::atomic<uint32_t> _uTail ;
+
+  public:
+    SaferRingBufferSpan( uint8_t *buffer, uint32_t size ) ;
+    void setBuffer( uint8_t *buffer, uint32_t size ) ;
+    int size() const { return (int)_uMask + 1; }
+    void store_char( uint8_t c ) ;
+    void clear();
+    int read_char();
+    int available();
+    int availableForStore();
+    int peek();
+    bool isFull();
+
+    int write(const uint8_t *buffer, int n);
+    int read(uint8_t *buffer, int n);
+
+    int writeRegions(ring_regions_t &regions);
+    int readRegions(ring_regions_t &regions);
+    void advanceHead(int n);
+    void advanceTail(int n);
+
+    // Number of bytes store_char threw away because the buffer was full.
+    // Only the producer updates it.
+    uint32_t overflowCount() const { return _uOverflow; }
+    void clearOverflowCount() { _uOverflow = 0; }
+
+  private:
+    uint32_t _uMask ;
+    volatile uint32_t _uOverflow ;
+};
+
+inline SaferRingBufferSpan::SaferRingBufferSpan( uint8_t *buffer, uint32_t size )
+{
+  setBuffer(buffer, size);
+}
+
+// Note: only safe when neither side is active.
+inline void SaferRingBufferSpan::setBuffer( uint8_t *buffer, uint32_t size )
+{
+  // round down to a power of two
+  while (size & (size - 1)) size &= size - 1;
+  _aucBuffer = buffer;
+  _uMask = size - 1;
+  if (_aucBuffer && size) memset(_aucBuffer, 0, size);
+  clear();
+}
+
+inline void SaferRingBufferSpan::store_char( uint8_t c )
+{
+  uint32_t head = _uHead.load(std::memory_order_relaxed);
+  if ((head - _uTail.load(std::memory_order_acquire)) <= _uMask)
+  {
+    _aucBuffer[head & _uMask] = c ;
+    _uHead.store(head + 1, std::memory_order_release);
+  } else {
+    _uOverflow = _uOverflow + 1;
+  }
+}
+
+// Note: only safe when neither side is active.
+inline void SaferRingBufferSpan::clear()
+{
+  _uHead.store(0, std::memory_order_relaxed);
+  _uTail.store(0, std::memory_order_relaxed);
+  _uOverflow = 0;
+}
+
+inline int SaferRingBufferSpan::read_char()
+{
+  uint32_t tail = _uTail.load(std::memory_order_relaxed);
+  if (_uHead.load(std::memory_order_acquire) == tail)
+    return -1;
+
+  uint8_t value = _aucBuffer[tail & _uMask];
+  _uTail.store(tail + 1, std::memory_order_release);
+
+  return value;
+}
+
+inline int SaferRingBufferSpan::available()
+{
+  uint32_t tail = _uTail.load(std::memory_order_acquire);
+  return (int)(_uHead.load(std::memory_order_acquire) - tail);
+}
+
+inline int SaferRingBufferSpan::availableForStore()
+{
+  uint32_t head = _uHead.load(std::memory_order_acquire);
+  return size() - (int)(head - _uTail.load(std::memory_order_acquire));
+}
+
+inline int SaferRingBufferSpan::peek()
+{
+  uint32_t tail = _uTail.load(std::memory_order_relaxed);
+  if (_uHead.load(std::memory_order_acquire) == tail)
+    return -1;
+
+  return _aucBuffer[tail & _uMask];
+}
+
+inline bool SaferRingBufferSpan::isFull()
+{
+  return availableForStore() == 0;
+}
+
+inline int SaferRingBufferSpan::writeRegions(ring_regions_t &regions)
+{
+  uint32_t head = _uHead.load(std::memory_order_relaxed);
+  int space = size() - (int)(head - _uTail.load(std::memory_order_acquire));
+  int index = head & _uMask;
+  int to_end = size() - index;
+  regions.ptr1 = &_aucBuffer[index];
+  regions.ptr2 = _aucBuffer;
+  regions.len1 = (space < to_end) ? space : to_end;
+  regions.len2 = space - regions.len1;
+  return space;
+}
+
+inline int SaferRingBufferSpan::readRegions(ring_regions_t &regions)
+{
+  uint32_t tail = _uTail.load(std::memory_order_relaxed);
+  int count = (int)(_uHead.load(std::memory_order_acquire) - tail);
+  int index = tail & _uMask;
+  int to_end = size() - index;
+  regions.ptr1 = &_aucBuffer[index];
+  regions.ptr2 = _aucBuffer;
+  regions.len1 = (count < to_end) ? count : to_end;
+  regions.len2 = count - regions.len1;
+  return count;
+}
+
+inline void SaferRingBufferSpan::advanceHead(int n)
+{
+  _uHead.store(_uHead.load(std::memory_order_relaxed) + n, std::memory_order_release);
+}
+
+inline void SaferRingBufferSpan::advanceTail(int n)
+{
+  _uTail.store(_uTail.load(std::memory_order_relaxed) + n, std::memory_order_release);
+}
+
+inline int SaferRingBufferSpan::write(const uint8_t *buffer, int n)
+{
+  ring_regions_t regions;
+  int cb = writeRegions(regions);
+  if (n < cb) cb = n;
+  if (cb <= 0) return 0;
+
+  int cb1 = (cb < regions.len1) ? cb : regions.len1;
+  memcpy(regions.ptr1, buffer, cb1);
+  if (cb > cb1) memcpy(regions.ptr2, buffer + cb1, cb - cb1);
+  advanceHead(cb);
+  return cb;
+}
+
+inline int SaferRingBufferSpan::read(uint8_t *buffer, int n)
+{
+  ring_regions_t regions;
+  int cb = readRegions(regions);
+  if (n < cb) cb = n;
+  if (cb <= 0) return 0;
+
+  int cb1 = (cb < regions.len1) ? cb : regions.len1;
+  memcpy(buffer, regions.ptr1, cb1);
+  if (cb > cb1) memcpy(buffer + cb1, regions.ptr2, cb - cb1);
+  advanceTail(cb);
+  return cb;
+}
+
+template <int N>
+class SaferRingBufferN<N, true> : public SaferRingBufferSpan
+{
+  public:
+    SaferRingBufferN( void ) : SaferRingBufferSpan(_aucStorage, N) {}
+
+  private:
+    uint8_t _aucStorage[N] ;
+};
+
 ///////////////////////////////////
 #if 0
 // Protect writes for potential multiple writers 
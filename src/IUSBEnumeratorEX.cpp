@@ -55,7 +55,7 @@ bool IUSBEnumeratorEx::cacheStringIndexes() {
   //printf(">>>>> IUSBEnumeratorEx::cacheStringIndexes() called <<<<< \n\r");
   DeviceDescriptor device_descriptor;
 
-  USB_TYPE res = host->controlRead(  dev,
+  USB_TYPE res = controlRead(  dev,
                          USB_DEVICE_TO_HOST | USB_RECIPIENT_DEVICE,
                          GET_DESCRIPTOR,
                          (DEVICE_DESCRIPTOR << 8) | (0),
@@ -74,7 +74,7 @@ bool IUSBEnumeratorEx::cacheStringIndexes() {
   // Now lets try to get the default language ID:
   uint8_t read_buffer[64]; 
   //printf(">>>>> Get Language ID <<<<<<\n\r");
-  res = host->controlRead(  dev,
+  res = controlRead(  dev,
                       USB_DEVICE_TO_HOST | USB_RECIPIENT_DEVICE,
                       GET_DESCRIPTOR,
                       0x300,
@@ -102,7 +102,7 @@ bool IUSBEnumeratorEx::getStringDesc(uint8_t index, uint8_t *buffer, size_t len)
   uint8_t read_len = len * 2 + 2;
   uint8_t read_buffer[read_len]; // will probably give compiler warning about variable length...
 
-   USB_TYPE res = host->controlRead(  dev,
+   USB_TYPE res = controlRead(  dev,
                       USB_DEVICE_TO_HOST | USB_RECIPIENT_DEVICE,
                       GET_DESCRIPTOR,
                       (STRING_DESCRIPTOR << 8) | (index),
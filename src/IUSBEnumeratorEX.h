@@ -20,6 +20,7 @@
 #include <Arduino_USBHostMbed5.h>
 #include "USBHost/USBHost.h"
 #include "USBHost/USBHostConf.h"
+#include "USBHostCapture.h"
 
 /**
  * A class to communicate a USB hser
@@ -51,6 +52,14 @@ protected:
   // should be part of higher level stuff...
   bool cacheStringIndexes();
 
+  // control transfers go through here so they can be captured.
+  USB_TYPE controlRead(USBDeviceConnected *dev, uint8_t requestType, uint8_t request, uint32_t value, uint32_t index, uint8_t *buf, uint32_t len) {
+    return USBHostCapture::controlRead(host, dev, requestType, request, value, index, buf, len);
+  }
+  USB_TYPE controlWrite(USBDeviceConnected *dev, uint8_t requestType, uint8_t request, uint32_t value, uint32_t index, uint8_t *buf, uint32_t len) {
+    return USBHostCapture::controlWrite(host, dev, requestType, request, value, index, buf, len);
+  }
+
 };
 
 #endif
@@ -0,0 +1,116 @@
+/* USBHost traffic capture
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "USBHostCapture.h"
+
+#ifdef USBHOST_CAPTURE
+#include <atomic>
+
+uint8_t *USBHostCapture::buffer_ = nullptr;
+uint32_t USBHostCapture::size_ = 0;
+uint32_t USBHostCapture::dropped_ = 0;
+static std::atomic<uint32_t> s_capture_used{0};
+
+void USBHostCapture::begin(uint8_t *buffer, uint32_t size) {
+  buffer_ = nullptr;
+  if (size < 4) return;
+  memcpy(buffer, USBHOST_CAPTURE_MAGIC, 4);
+  size_ = size;
+  dropped_ = 0;
+  s_capture_used = 4;
+  buffer_ = buffer;
+}
+
+void USBHostCapture::end() {
+  buffer_ = nullptr;
+}
+
+uint32_t USBHostCapture::length() {
+  return s_capture_used.load();
+}
+
+// Claim size bytes, called from the USB thread and the sketch, so the
+// space is taken with a compare exchange and a record is never split.
+uint8_t *USBHostCapture::reserve(uint32_t size) {
+  uint8_t *buffer = buffer_;
+  if (!buffer) return nullptr;
+  uint32_t used = s_capture_used.load();
+  do {
+    if ((used + size) > size_) {
+      dropped_++;
+      return nullptr;
+    }
+  } while (!s_capture_used.compare_exchange_weak(used, used + size));
+  return buffer + used;
+}
+
+void USBHostCapture::recordDevice(USBHost *host, USBDeviceConnected *dev) {
+  if (!buffer_ || !dev) return;
+  // Read the descriptors again, the driver does not get to see the ones
+  // the host read while enumerating.
+  uint8_t desc[512];
+  if (host->controlRead(dev, 0x80, 6, 0x100, 0, desc, 18) != USB_TYPE_OK) return;
+  if (host->controlRead(dev, 0x80, 6, 0x200, 0, desc + 18, 9) != USB_TYPE_OK) return;
+  uint16_t conf_len = desc[18 + 2] | (desc[18 + 3] << 8);
+  if (conf_len > (sizeof(desc) - 18)) conf_len = sizeof(desc) - 18;
+  if (host->controlRead(dev, 0x80, 6, 0x200, 0, desc + 18, conf_len) != USB_TYPE_OK) return;
+
+  uint8_t *p = reserve(sizeof(usbhost_capture_record_t) + 18 + conf_len);
+  if (!p) return;
+  usbhost_capture_record_t rec = {micros(), CAPTURE_DEVICE, dev->getAddress(), 0, 0, (uint16_t)(18 + conf_len)};
+  memcpy(p, &rec, sizeof(rec));
+  memcpy(p + sizeof(rec), desc, 18 + conf_len);
+}
+
+void USBHostCapture::recordIn(USBDeviceConnected *dev, USBEndpoint *ep) {
+  if (!buffer_ || !dev || !ep) return;
+  uint32_t len = ep->getLengthTransferred();
+  uint8_t *p = reserve(sizeof(usbhost_capture_record_t) + len);
+  if (!p) return;
+  usbhost_capture_record_t rec = {micros(), CAPTURE_IN, dev->getAddress(), ep->getAddress(), 0, (uint16_t)len};
+  memcpy(p, &rec, sizeof(rec));
+  if (len) memcpy(p + sizeof(rec), ep->getBufStart(), len);
+}
+
+void USBHostCapture::recordControl(uint8_t type, USBDeviceConnected *dev, uint8_t requestType, uint8_t request,
+                                   uint32_t value, uint32_t index, const uint8_t *buf, uint32_t len, USB_TYPE res) {
+  if (!buffer_ || !dev) return;
+  uint32_t cb = buf ? len : 0;
+  uint8_t *p = reserve(sizeof(usbhost_capture_record_t) + sizeof(usbhost_capture_setup_t) + cb);
+  if (!p) return;
+  usbhost_capture_record_t rec = {micros(), type, dev->getAddress(), (uint8_t)res, 0, (uint16_t)cb};
+  usbhost_capture_setup_t setup = {requestType, request, (uint16_t)value, (uint16_t)index, (uint16_t)len};
+  memcpy(p, &rec, sizeof(rec));
+  memcpy(p + sizeof(rec), &setup, sizeof(setup));
+  if (cb) memcpy(p + sizeof(rec) + sizeof(setup), buf, cb);
+}
+
+void USBHostCapture::dump(Print &pr) {
+  if (!buffer_) return;
+  uint32_t len = length();
+  char line[2 * 32 + 2];
+  for (uint32_t i = 0; i < len; i += 32) {
+    char *pb = line;
+    for (uint32_t j = i; (j < i + 32) && (j < len); j++) {
+      static const char hex[] = "0123456789abcdef";
+      *pb++ = hex[buffer_[j] >> 4];
+      *pb++ = hex[buffer_[j] & 0xf];
+    }
+    *pb++ = '\n';
+    *pb = 0;
+    pr.print(line);
+  }
+}
+#endif
@@ -0,0 +1,118 @@
+/* USBHost traffic capture
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __USBHOSTCAPTURE_H__
+#define __USBHOSTCAPTURE_H__
+#include <Arduino.h>
+#include <Arduino_USBHostMbed5.h>
+#include "USBHost/USBHost.h"
+
+// Uncomment to record the USB traffic the drivers see: the device they
+// connect to, every IN completion handed to an rxHandler and every control
+// transfer.  The capture can be replayed off target with
+// extras/host_sim/USBHostReplay.  When it is not defined the hooks compile
+// to nothing and the control wrappers are plain forwarders.
+//#define USBHOST_CAPTURE
+
+// Capture format, all little endian.  The file starts with the 4 byte
+// magic "UHC1", followed by records:
+//   usbhost_capture_record_t header
+//   control records: 8 byte setup packet (wLength is the requested length)
+//   len bytes of data: for DEVICE the device descriptor followed by the
+//   configuration descriptor, for IN the packet, for control transfers
+//   the data returned or sent.
+#define USBHOST_CAPTURE_MAGIC "UHC1"
+
+enum {
+  CAPTURE_DEVICE = 1,      // arg: unused
+  CAPTURE_IN,              // arg: endpoint address
+  CAPTURE_CONTROL_READ,    // arg: USB_TYPE result
+  CAPTURE_CONTROL_WRITE    // arg: USB_TYPE result
+};
+
+typedef struct __attribute__((packed)) {
+  uint32_t time_us;
+  uint8_t type;
+  uint8_t dev;     // device address
+  uint8_t arg;
+  uint8_t reserved;
+  uint16_t len;    // data bytes that follow the header (and setup)
+} usbhost_capture_record_t;
+
+typedef struct __attribute__((packed)) {
+  uint8_t bmRequestType;
+  uint8_t bRequest;
+  uint16_t wValue;
+  uint16_t wIndex;
+  uint16_t wLength;
+} usbhost_capture_setup_t;
+
+class USBHostCapture {
+public:
+#ifdef USBHOST_CAPTURE
+  // Start capturing into the callers buffer.  Records that do not fit are
+  // dropped and counted.
+  static void begin(uint8_t *buffer, uint32_t size);
+  static void end();
+  static const uint8_t *data() { return buffer_; }
+  static uint32_t length();
+  static uint32_t dropped() { return dropped_; }
+
+  // Write the capture as hex text, which xxd -r -p turns back into the
+  // binary the replay reads.  Do not call it while the drivers are busy.
+  static void dump(Print &pr);
+
+  static void recordDevice(USBHost *host, USBDeviceConnected *dev);
+  static void recordIn(USBDeviceConnected *dev, USBEndpoint *ep);
+  static void recordControl(uint8_t type, USBDeviceConnected *dev, uint8_t requestType, uint8_t request,
+                            uint32_t value, uint32_t index, const uint8_t *buf, uint32_t len, USB_TYPE res);
+#endif
+
+  // The drivers make their control transfers through these
+  static inline USB_TYPE controlRead(USBHost *host, USBDeviceConnected *dev, uint8_t requestType, uint8_t request,
+                                     uint32_t value, uint32_t index, uint8_t *buf, uint32_t len) {
+    USB_TYPE res = host->controlRead(dev, requestType, request, value, index, buf, len);
+#ifdef USBHOST_CAPTURE
+    recordControl(CAPTURE_CONTROL_READ, dev, requestType, request, value, index, buf, len, res);
+#endif
+    return res;
+  }
+  static inline USB_TYPE controlWrite(USBHost *host, USBDeviceConnected *dev, uint8_t requestType, uint8_t request,
+                                      uint32_t value, uint32_t index, uint8_t *buf, uint32_t len) {
+    USB_TYPE res = host->controlWrite(dev, requestType, request, value, index, buf, len);
+#ifdef USBHOST_CAPTURE
+    recordControl(CAPTURE_CONTROL_WRITE, dev, requestType, request, value, index, buf, len, res);
+#endif
+    return res;
+  }
+
+#ifdef USBHOST_CAPTURE
+private:
+  static uint8_t *reserve(uint32_t size);
+  static uint8_t *buffer_;
+  static uint32_t size_;
+  static uint32_t dropped_;
+#endif
+};
+
+#ifdef USBHOST_CAPTURE
+#define USBHOST_CAPTURE_DEVICE(host, dev) USBHostCapture::recordDevice((host), (dev))
+#define USBHOST_CAPTURE_IN(dev, ep) USBHostCapture::recordIn((dev), (ep))
+#else
+#define USBHOST_CAPTURE_DEVICE(host, dev) ((void)0)
+#define USBHOST_CAPTURE_IN(dev, ep) ((void)0)
+#endif
+
+#endif
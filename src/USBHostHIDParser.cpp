@@ -45,23 +45,42 @@ void inline VDBGPrintf(...) {};
 
 // Lets try to read in the HID Descriptor
 bool USBHostHIDParser::init(USBHost *host, USBDeviceConnected *dev, uint8_t index, uint16_t len) {
+  DBGPrintf("USBHostHIDParser::init(%p %p %u %u)\n", host, dev, index, len);
+  release();
   host_ = host;
   dev_ = dev;
   index_ = index;
   descriptor_length_ = len;
-
-  DBGPrintf("USBHostHIDParser::init(%p %p %u %u)\n", host, dev, index, len);
   if ((dev == nullptr) || (index == 0xff)) return false;
 
-  if (descriptor_buffer_ != nullptr) {
-    free((void *)descriptor_buffer_);
-  }
+  // Same device plugged in again?  Then we already know its descriptor.
+  if (loadFromCache()) return true;
 
-  descriptor_buffer_ = (uint8_t *)malloc(len);
+  descriptor_length_ = len;  // a failed load releases everything
+  descriptor_buffer_ = (uint8_t *)arenaAlloc(len);
   if (!descriptor_buffer_) return false;
 
   if (!getHIDDescriptor()) return false;
+  if (!setupDescriptor()) return false;
+  saveToCache();
+  return true;
+}
+
+bool USBHostHIDParser::initFromDescriptor(const uint8_t *descriptor, uint16_t len) {
+  DBGPrintf("USBHostHIDParser::initFromDescriptor(%p %u)\n", descriptor, len);
+  release();
+  host_ = nullptr;
+  dev_ = nullptr;
+  index_ = 0xff;
+  descriptor_length_ = len;
+
+  descriptor_buffer_ = (uint8_t *)arenaAlloc(len);
+  if (!descriptor_buffer_) return false;
+  memcpy(descriptor_buffer_, descriptor, len);
+  return setupDescriptor();
+}
 
+bool USBHostHIDParser::setupDescriptor() {
   // lets do an initial walk through to see if the HID contains report ids...
   const uint8_t *p = descriptor_buffer_;
   const uint8_t *end = p + descriptor_length_;
@@ -73,10 +92,13 @@ bool USBHostHIDParser::init(USBHost *host, USBDeviceConnected *dev, uint8_t inde
   use_report_id_ = false;
   while (p < end) {
     uint8_t tag = *p;
-    if (tag == 0xFE) {  // Long Item
-      p += *p + 3;
+    if (tag == 0xFE) {  // Long Item, skip its data
+      if (p + 1 >= end) break;
+      p += p[1] + 3;
       continue;
     }
+    // make sure the whole item is there before reading it
+    if (p + 1 + (((tag & 3) == 3) ? 4 : (tag & 3)) > end) break;
     uint32_t val = 0;
     switch (tag & 0x03) {  // Short Item data
       case 0:
@@ -130,10 +152,11 @@ bool USBHostHIDParser::init(USBHost *host, USBDeviceConnected *dev, uint8_t inde
         break;
     }
   }
-  return true;
+  return compileReports();
 }
 
-// Extract 1 to 32 bits from the data array, starting at bitindex.
+// Extract 1 to 32 bits from the data array, starting at bitindex.  Wider
+// fields give their low 32 bits.
 static uint32_t bitfield(const uint8_t *data, uint32_t bitindex, uint32_t numbits)
 {
 	uint32_t output = 0;
@@ -144,12 +167,33 @@ static uint32_t bitfield(const uint8_t *data, uint32_t bitindex, uint32_t numbit
 		output = (*data++) >> offset;
 		bitcount = 8 - offset;
 	}
-	while (bitcount < numbits) {
+	while ((bitcount < numbits) && (bitcount < 32)) {
 		output |= (uint32_t)(*data++) << bitcount;
 		bitcount += 8;
 	}
 	if (bitcount > numbits && numbits < 32) {
-		output &= ((1 << numbits) - 1);
+		output &= ((1u << numbits) - 1);
+	}
+	return output;
+}
+
+// Same for fields up to 64 bits.
+static uint64_t bitfield64(const uint8_t *data, uint32_t bitindex, uint32_t numbits)
+{
+	uint64_t output = 0;
+	uint32_t bitcount = 0;
+	data += (bitindex >> 3);
+	uint32_t offset = bitindex & 7;
+	if (offset) {
+		output = (*data++) >> offset;
+		bitcount = 8 - offset;
+	}
+	while ((bitcount < numbits) && (bitcount < 64)) {
+		output |= (uint64_t)(*data++) << bitcount;
+		bitcount += 8;
+	}
+	if (numbits < 64) {
+		output &= ((uint64_t)1 << numbits) - 1;
 	}
 	return output;
 }
@@ -158,8 +202,8 @@ static uint32_t bitfield(const uint8_t *data, uint32_t bitindex, uint32_t numbit
 // so the result is a proper 32 bit signed integer.
 static int32_t signext(uint32_t num, uint32_t bitcount)
 {
-	if (bitcount < 32 && bitcount > 0 && (num & (1 << (bitcount-1)))) {
-		num |= ~((1 << bitcount) - 1);
+	if (bitcount < 32 && bitcount > 0 && (num & (1u << (bitcount-1)))) {
+		num |= ~((1u << bitcount) - 1);
 	}
 	return (int32_t)num;
 }
@@ -174,39 +218,165 @@ static int32_t signedval(uint32_t num, uint8_t tag)
 }
 
 
-void USBHostHIDParser::parse( const uint8_t *data, uint16_t len)
+// Pick the cheapest way to get a field out of a report that is report_bytes
+// long without reading past the end of it.  HID data is little endian, as
+// is the processor, so the loads below need no byte swapping.
+void USBHostHIDParser::setExtract(hid_field_t &f, uint16_t report_bytes) {
+  if ((f.op == HID_FIELD_BEGIN) || (f.op == HID_FIELD_END)) return;
+  uint16_t byte_index = f.bit_offset >> 3;
+  uint8_t shift = f.bit_offset & 7;
+  uint8_t extract = HID_EXTRACT_BYTES;
+  if ((shift == 0) && (f.size == 8)) extract = HID_EXTRACT_U8;
+  else if ((shift == 0) && (f.size == 16)) extract = HID_EXTRACT_U16;
+  else if ((shift + f.size <= 32) && (byte_index + 4 <= report_bytes)) extract = HID_EXTRACT_LOAD32;
+  else if ((shift + f.size <= 64) && (byte_index + 8 <= report_bytes)) extract = HID_EXTRACT_LOAD64;
+  f.flags = (f.flags & ~HID_FIELD_EXTRACT_MASK) | extract;
+}
+
+// Extract a field set up by setExtract().
+static inline uint32_t extractField(const uint8_t *data, const hid_field_t *f)
+{
+  const uint8_t *p = data + (f->bit_offset >> 3);
+  uint32_t mask = (f->size < 32) ? ((1ul << f->size) - 1) : 0xffffffff;
+  switch (f->flags & HID_FIELD_EXTRACT_MASK) {
+    case HID_EXTRACT_U8:
+      return *p;
+    case HID_EXTRACT_U16:
+      {
+        uint16_t w;
+        memcpy(&w, p, sizeof(w));
+        return w;
+      }
+    case HID_EXTRACT_LOAD32:
+      {
+        uint32_t w;
+        memcpy(&w, p, sizeof(w));
+        return (w >> (f->bit_offset & 7)) & mask;
+      }
+    case HID_EXTRACT_LOAD64:
+      {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        return (uint32_t)(w >> (f->bit_offset & 7)) & mask;
+      }
+  }
+  return bitfield(data, f->bit_offset, f->size);
+}
+
+// All the bits of a field, for ones wider than the 32 bits hid_input_data
+// can pass along.  data is the report after the report ID.
+uint64_t USBHostHIDParser::fieldValue64(const uint8_t *data, const hid_field_t &f) {
+  uint64_t n = bitfield64(data, f.bit_offset, f.size);
+  if ((f.flags & HID_FIELD_SIGNED) && (f.size < 64) && (n & ((uint64_t)1 << (f.size - 1)))) {
+    n |= ~(((uint64_t)1 << f.size) - 1);
+  }
+  return n;
+}
+
+// Did any of the bits of the field change, xor is the old report ^ new one.
+static inline bool fieldChanged(const uint8_t *xor_data, const hid_field_t *f)
 {
+  if (f->size > 32) return bitfield64(xor_data, f->bit_offset, f->size) != 0;
+  return extractField(xor_data, f) != 0;
+}
+
+// The most usage items (Usage, Usage Minimum, Usage Maximum) any one main
+// item has, so compileDescriptor knows how long its usage list must be.
+uint16_t USBHostHIDParser::maxUsagesPerItem() {
   const uint8_t *p = descriptor_buffer_;
   const uint8_t *end = p + descriptor_length_;
+  uint16_t count = 0;
+  uint16_t max_count = 0;
+  while (p < end) {
+    uint8_t tag = *p;
+    if (tag == 0xFE) {
+      if (p + 1 >= end) break;
+      p += p[1] + 3;
+      continue;
+    }
+    p += 1 + ((tag & 3) == 3 ? 4 : (tag & 3));
+    switch (tag & 0xFC) {
+      case 0x08: // Usage
+      case 0x18: // Usage Minimum
+      case 0x28: // Usage Maximum
+        if (++count > max_count) max_count = count;
+        break;
+      case 0x80: // Input
+      case 0x90: // Output
+      case 0xB0: // Feature
+      case 0xA0: // Collection
+      case 0xC0: // End Collection
+        count = 0;
+        break;
+    }
+  }
+  return max_count;
+}
+
+// Walk the descriptor once and turn every Input item into field records,
+// in the order parse() makes its callbacks.  When fields is null only
+// count them.  Returns false for a descriptor we refuse or when the arena
+// is full, a descriptor with no fields is fine.
+bool USBHostHIDParser::compileDescriptor(hid_field_t *fields, uint16_t &count)
+{
+  count = 0;
+  const uint8_t *p = descriptor_buffer_;
+  const uint8_t *end = p + descriptor_length_;
+
+	// Room for every usage of the busiest item, at least 2 for the min/max.
+	// Zeroed, the min/max walk reads the pair after the last one.
+	uint16_t usage_list_len = maxUsagesPerItem() + 2;
+	uint32_t *usage = (uint32_t *)arenaAlloc(usage_list_len * sizeof(uint32_t));
+	if (!usage) return false;
+	memset(usage, 0, usage_list_len * sizeof(uint32_t));
 
 	uint32_t topusage = 0;
 	uint8_t collection_level = 0;
-	uint16_t usage[USAGE_LIST_LEN] = {0, 0};
-	uint8_t usage_count = 0;
-	uint8_t usage_min_max_count = 0;
+	uint16_t usage_count = 0;
+	bool usage_min_max = false;  // the usages are min/max pairs, not a list
+	uint16_t usage_min_max_count = 0;
 	uint8_t usage_min_max_mask = 0;
 	uint8_t report_id = 0;
 	uint16_t report_size = 0;
 	uint16_t report_count = 0;
 	uint16_t usage_page = 0;
-	uint32_t last_usage = 0;
 	int32_t logical_min = 0;
 	int32_t logical_max = 0;
-	uint32_t bitindex = 0;
-  uint8_t buffer_report_id = 0;
-  
-  if (use_report_id_) {
-    buffer_report_id = *data++;
-    len--;
-  }
+  uint16_t field_count = 0;
+  // Each report ID has its own bit offsets
+  uint8_t report_ids[MAX_REPORT_IDS] = {0};
+  // Input, Output and Feature reports each have their own too
+  uint16_t report_bitindex[3][MAX_REPORT_IDS] = {{0}};
+  // and their own last usage, for fields with no usages of their own
+  uint32_t last_usage[MAX_REPORT_IDS] = {0};
+  uint8_t report_id_count = 1;  // slot 0 is for report ID 0
+  uint8_t report_slot = 0;
+  hid_field_t f;
+  bool failed = false;
+
+  // The global items saved by Push
+  typedef struct {
+    uint16_t usage_page;
+    int32_t logical_min;
+    int32_t logical_max;
+    uint16_t report_size;
+    uint16_t report_count;
+    uint8_t report_id;
+    uint8_t report_slot;
+  } hid_globals_t;
+  hid_globals_t global_stack[GLOBAL_STACK_DEPTH];
+  uint8_t global_stack_count = 0;
 
-  DBGPrintf("parse: %p %u: %u %u\n", data, len, use_report_id_, buffer_report_id);
-	while (p < end) {
+  DBGPrintf("compileDescriptor: %p %u\n", fields, use_report_id_);
+	while ((p < end) && !failed) {
 		uint8_t tag = *p;
-		if (tag == 0xFE) { // Long Item (unsupported)
+		if (tag == 0xFE) { // Long Item, no long item tags are defined so skip it
+			if (p + 1 >= end) break;
 			p += p[1] + 3;
 			continue;
 		}
+		// make sure the whole item is there before reading it
+		if (p + 1 + (((tag & 3) == 3) ? 4 : (tag & 3)) > end) break;
 		uint32_t val = 0;
 		switch (tag & 0x03) { // Short Item data
 		  case 0: val = 0;
@@ -244,24 +414,57 @@ void USBHostHIDParser::parse( const uint8_t *data, uint16_t len)
 		  case 0x84: // Report ID (global)
       DBGPrintf("    Set Report ID: %u\n", val);
 			report_id = val;
+			for (report_slot = 0; report_slot < report_id_count; report_slot++) {
+				if (report_ids[report_slot] == report_id) break;
+			}
+			if (report_slot == report_id_count) {
+				if (report_id_count == MAX_REPORT_IDS) { // more than we can track
+					failed = true;
+					break;
+				}
+				report_ids[report_id_count++] = report_id;
+			}
+			break;
+		  case 0xA4: // Push (global)
+			if (global_stack_count == GLOBAL_STACK_DEPTH) {
+				DBGPrintf("    Push: stack full\n");
+				failed = true;
+				break;
+			}
+			global_stack[global_stack_count++] = {usage_page, logical_min, logical_max, report_size, report_count,
+			                                      report_id, report_slot};
+			break;
+		  case 0xB4: // Pop (global)
+			if (global_stack_count) {
+				hid_globals_t &g = global_stack[--global_stack_count];
+				usage_page = g.usage_page;
+				logical_min = g.logical_min;
+				logical_max = g.logical_max;
+				report_size = g.report_size;
+				report_count = g.report_count;
+				report_id = g.report_id;
+				report_slot = g.report_slot;
+			}
 			break;
 		  case 0x08: // Usage (local)
-			if (usage_count < USAGE_LIST_LEN) {
+			if (!usage_min_max && (usage_count < usage_list_len)) {
 				// Usages: 0 is reserved 0x1-0x1f is sort of reserved for top level things like
 				// 0x1 - Pointer - A collection... So lets try ignoring these
-				if (val > 0x1f) {
-					usage[usage_count++] = val;
+				// A 4 byte usage has its own usage page in the top 16 bits.
+				if ((val & 0xffff) > 0x1f) {
+					usage[usage_count++] = ((tag & 3) == 3) ? val : (val & 0xffff);
 				}
         DBGPrintf("    Usage: %lx cnt:%u\n", val, usage_count);
 			}
 			break;
 		  case 0x18: // Usage Minimum (local)
 		  	// Note: Found a report with multiple min/max
-		  	if (usage_count != 255) {
-				usage_count = 255;
+		  	if (!usage_min_max) {
+				usage_min_max = true;
 			  	usage_min_max_count = 0;
 				usage_min_max_mask = 0;
 			}
+			if (usage_min_max_count * 2 + 1 >= usage_list_len) break;
 			usage[usage_min_max_count * 2] = val;
 			usage_min_max_mask |= 1;
 			if (usage_min_max_mask == 3) {
@@ -270,11 +473,12 @@ void USBHostHIDParser::parse( const uint8_t *data, uint16_t len)
 		  	}
 			break;
 		  case 0x28: // Usage Maximum (local)
-		  	if (usage_count != 255) {
-				usage_count = 255;
+		  	if (!usage_min_max) {
+				usage_min_max = true;
 			  	usage_min_max_count = 0;
 				usage_min_max_mask = 0;
 			}
+			if (usage_min_max_count * 2 + 1 >= usage_list_len) break;
 			usage[usage_min_max_count * 2 + 1] = val;
 			usage_min_max_mask |= 2;
 			if (usage_min_max_mask == 3) {
@@ -284,7 +488,7 @@ void USBHostHIDParser::parse( const uint8_t *data, uint16_t len)
 			break;
 		  case 0xA0: // Collection
 			if (collection_level == 0) {
-				topusage = ((uint32_t)usage_page << 16) | usage[0];
+				topusage = (usage[0] > 0xffff) ? usage[0] : (((uint32_t)usage_page << 16) | usage[0]);
 			}
 			// discard collection info if not top level, hopefully that's ok?
 			collection_level++;
@@ -293,21 +497,71 @@ void USBHostHIDParser::parse( const uint8_t *data, uint16_t len)
 		  case 0xC0: // End Collection
 			if (collection_level > 0) {
 				collection_level--;
-			  if (hidCB_) hidCB_->hid_input_end();
+				// parse() calls hid_input_end for these in every report
+				memset(&f, 0, sizeof(f));
+				f.op = HID_FIELD_END;
+				if (fields) fields[field_count] = f;
+				field_count++;
 			}
 			reset_local = true;
 			break;
 		  case 0x80: // Input
-      DBGPrintf("    Input: %u %u == %u?\n", use_report_id_, report_id, buffer_report_id);
-			if (use_report_id_ && (report_id != buffer_report_id)) {
-				// completely ignore and do not advance bitindex
-				// for descriptors of other report IDs
-				reset_local = true;
+		  case 0x90: // Output
+		  case 0xB0: // Feature
+      DBGPrintf("    Main %x: %u %u\n", tag, use_report_id_, report_id);
+			{
+			uint8_t report_type = ((tag & 0xFC) == 0x80) ? HID_REPORT_INPUT
+			                      : ((tag & 0xFC) == 0x90) ? HID_REPORT_OUTPUT : HID_REPORT_FEATURE;
+			// bit offsets are per report type and ID
+			uint16_t &bitindex = report_bitindex[report_type - 1][report_slot];
+			// Do not let a bogus descriptor overflow the bit offsets or the field count
+			if (((uint32_t)bitindex + (uint32_t)report_count * report_size > MAX_REPORT_BITS)
+			    || (!(val & 1) && ((uint32_t)field_count + report_count + 1 > MAX_FIELDS))) {
+				DBGPrintf("    report too large: %u %u %u\n", bitindex, report_count, report_size);
+				failed = true;
 				break;
 			}
-			if ((val & 1)) {
-				// skip past constant fields or when no driver is listening
+			if ((val & 1) || (report_size > 64)) {
+				// skip past constant fields, and ones too wide to extract
 				bitindex += report_count * report_size;
+			} else if (report_type != HID_REPORT_INPUT) {
+				// Output and Feature fields are only for building reports,
+				// give each one its usage, the builder does the rest.
+				uint32_t uindex = usage[0];
+				uint32_t uindex_max = usage[1];
+				uint16_t uminmax_index = 0;
+				for (uint32_t i = 0; i < report_count; i++) {
+					uint32_t u = 0;
+					if (!(val & 2)) {
+						u = (uint32_t)usage_page << 16;  // array, the value is the usage
+					} else if (usage_min_max) {
+						u = uindex;
+						if (uindex < uindex_max) uindex++;
+						else if (uminmax_index < usage_min_max_count) {
+							uminmax_index++;
+							uindex = usage[uminmax_index * 2];
+							uindex_max = usage[uminmax_index * 2 + 1];
+						}
+					} else if (usage_count) {
+						u = usage[(i < usage_count) ? i : usage_count - 1];
+					}
+					if (u <= 0xffff) u |= (uint32_t)usage_page << 16;
+					if (fields) {
+						hid_field_t &of = fields[field_count];
+						memset(&of, 0, sizeof(of));
+						of.op = (val & 2) ? HID_FIELD_VARIABLE : HID_FIELD_ARRAY;
+						of.report_id = report_id;
+						of.bit_offset = bitindex;
+						of.size = report_size;
+						of.flags = (logical_min < 0) ? HID_FIELD_SIGNED : 0;
+						of.type = report_type;
+						of.usage = u;
+						of.logical_min = logical_min;
+						of.logical_max = logical_max;
+					}
+					field_count++;
+					bitindex += report_size;
+				}
 			} else {
 				DBGPrintf("begin, usage=%lx\n", topusage);
 				DBGPrintf("       type= %lx\n", val);
@@ -317,15 +571,24 @@ void USBHostHIDParser::parse( const uint8_t *data, uint16_t len)
 				DBGPrintf("       usage count=%ld\n", usage_count);
 				DBGPrintf("       usage min max count=%ld\n", usage_min_max_count);
 
-				if (hidCB_) hidCB_->hid_input_begin(topusage, val, logical_min, logical_max);
+				memset(&f, 0, sizeof(f));
+				f.op = HID_FIELD_BEGIN;
+				f.report_id = report_id;
+				f.type = val;
+				f.usage = topusage;
+				f.logical_min = logical_min;
+				f.logical_max = logical_max;
+				if (fields) fields[field_count] = f;
+				field_count++;
 				DBGPrintf("Input, total bits=%d\n", report_count * report_size);
+				uint8_t field_flags = ((logical_min < 0) ? HID_FIELD_SIGNED : 0) | ((val & 4) ? HID_FIELD_RELATIVE : 0);
 				if ((val & 2)) {
 					// ordinary variable format
 					uint32_t uindex = 0;
 					uint32_t uindex_max = 0xffff;	// assume no MAX
 					bool uminmax = false;
 					uint8_t uminmax_index = 0;
-					if (usage_count > USAGE_LIST_LEN) {
+					if (usage_min_max) {
 						// usage numbers by min/max, not from list
 						uindex = usage[0];
 						uindex_max = usage[1];
@@ -337,7 +600,7 @@ void USBHostHIDParser::parse( const uint8_t *data, uint16_t len)
 							uindex = usage[0];
 						} else {
 							// BUGBUG:: Not sure good place to start?  maybe round up from last usage to next higher group up of 0x100?
-							uindex = (last_usage & 0xff00) + 0x100;
+							uindex = (last_usage[report_slot] & 0xff00) + 0x100;
 						}
 						uminmax = true;
 					}
@@ -355,24 +618,16 @@ void USBHostHIDParser::parse( const uint8_t *data, uint16_t len)
 								//USBHDBGSerial.DBGPrintf("$$ next min/max pair: %u %u %u\n", uminmax_index, uindex, uindex_max);
 							}
 						} else {
-							u = usage[uindex++];
-							if (uindex >= USAGE_LIST_LEN-1) {
-								uindex = USAGE_LIST_LEN-1;
-							}
+							// the last usage is used for the rest of the fields
+							u = usage[uindex];
+							if (uindex + 1 < usage_count) uindex++;
 						}
-						last_usage = u;	// remember the last one we used... 
-						u |= (uint32_t)usage_page << 16;
+						last_usage[report_slot] = u;	// remember the last one we used... 
+						if (u <= 0xffff) u |= (uint32_t)usage_page << 16;
 						DBGPrintf("  usage = %lx", u);
 
-						uint32_t n = bitfield(data, bitindex, report_size);
-						if (logical_min >= 0) {
-							DBGPrintf("  data = %lu\n", n);
-							if (hidCB_) hidCB_->hid_input_data(u, n);
-						} else {
-							int32_t sn = signext(n, report_size);
-							DBGPrintf("  sdata = %ld\n", sn);
-							if (hidCB_) hidCB_->hid_input_data(u, sn);
-						}
+						if (fields) setVariableField(fields[field_count], report_id, bitindex, report_size, u, field_flags);
+						field_count++;
 						bitindex += report_size;
 					}
 				} else {
@@ -395,46 +650,33 @@ void USBHostHIDParser::parse( const uint8_t *data, uint16_t len)
 							}
 
 							u |= (uint32_t)usage_page << 16;
-							uint32_t n = bitfield(data, bitindex, report_size);
-							if (logical_min >= 0) {
-								DBGPrintf("  data = %lu\n", n);
-								if (hidCB_) hidCB_->hid_input_data(u, n);
-							} else {
-								int32_t sn = signext(n, report_size);
-								DBGPrintf("  sdata = %lu", sn);
-								if (hidCB_) hidCB_->hid_input_data(u, sn);
-							}
-
+							if (fields) setVariableField(fields[field_count], report_id, bitindex, report_size, u, field_flags);
+							field_count++;
 							bitindex += report_size;
 						}
 
 					} else {
 						for (uint32_t i=0; i < report_count; i++) {
-							uint32_t u = bitfield(data, bitindex, report_size);
-							int n = u;
-							if (n >= logical_min && n <= logical_max) {
-								u |= (uint32_t)usage_page << 16;
-								DBGPrintf("  usage = %lx", u);
-								DBGPrintf("  data = 1\n");
-								if (hidCB_) hidCB_->hid_input_data(u, 1);
-							} else {
-								DBGPrintf ("  usage =%lx", u);
-								DBGPrintf(" out of range: %lx", logical_min);
-								DBGPrintf(" %lx\n", logical_max);
+							// the value is the usage, only known when the report comes in
+							if (fields) {
+								hid_field_t &af = fields[field_count];
+								memset(&af, 0, sizeof(af));
+								af.op = HID_FIELD_ARRAY;
+								af.report_id = report_id;
+								af.type = HID_REPORT_INPUT;
+								af.bit_offset = bitindex;
+								af.size = report_size;
+								af.usage = (uint32_t)usage_page << 16;
+								af.logical_min = logical_min;
+								af.logical_max = logical_max;
 							}
+							field_count++;
 							bitindex += report_size;
 						}
 					}
 				}
 			}
-			reset_local = true;
-			break;
-		  case 0x90: // Output
-			// TODO.....
-			reset_local = true;
-			break;
-		  case 0xB0: // Feature
-			// TODO.....
+			}
 			reset_local = true;
 			break;
 
@@ -444,8 +686,6 @@ void USBHostHIDParser::parse( const uint8_t *data, uint16_t len)
 		  case 0x64: // Unit (global)
 			break; // Ignore these commonly used tags.  Hopefully not needed?
 
-		  case 0xA4: // Push (yikes! Hope nobody really uses this?!)
-		  case 0xB4: // Pop (yikes! Hope nobody really uses this?!)
 		  case 0x38: // Designator Index (local)
 		  case 0x48: // Designator Minimum (local)
 		  case 0x58: // Designator Maximum (local)
@@ -459,18 +699,762 @@ void USBHostHIDParser::parse( const uint8_t *data, uint16_t len)
 		}
 		if (reset_local) {
 			usage_count = 0;
+			usage_min_max = false;
 			usage_min_max_count = 0;
 			usage[0] = 0;
 			usage[1] = 0;
 		}
 	}
+	arenaFree(usage);
+	if (failed) return false;
+
+	// How long each Output and Feature report is, constant padding included
+	for (uint8_t report_type = HID_REPORT_OUTPUT; report_type <= HID_REPORT_FEATURE; report_type++) {
+		for (uint8_t slot = 0; slot < report_id_count; slot++) {
+			if (report_bitindex[report_type - 1][slot] == 0) continue;
+			if (fields) {
+				hid_field_t &lf = fields[field_count];
+				memset(&lf, 0, sizeof(lf));
+				lf.op = HID_FIELD_LENGTH;
+				lf.report_id = report_ids[slot];
+				lf.type = report_type;
+				lf.bit_offset = report_bitindex[report_type - 1][slot];
+			}
+			field_count++;
+		}
+	}
+	count = field_count;
+	return true;
+}
+
+void USBHostHIDParser::setVariableField(hid_field_t &f, uint8_t report_id, uint16_t bit_offset, uint8_t size,
+                                        uint32_t usage, uint8_t flags) {
+  memset(&f, 0, sizeof(f));
+  f.op = HID_FIELD_VARIABLE;
+  f.report_id = report_id;
+  f.type = HID_REPORT_INPUT;
+  f.bit_offset = bit_offset;
+  f.size = size;
+  f.flags = flags;
+  f.usage = usage;
+}
+
+// Compile the descriptor and then lay the fields out one report ID after
+// another, so parse() only looks at the fields of the report it was given.
+// parse() calls hid_input_end at every End Collection no matter which
+// report came in, so each span gets its own copy of those.
+bool USBHostHIDParser::compileReports() {
+  freeReports();
+  uint16_t count;
+  if (!compileDescriptor(nullptr, count)) return false;
+  if (count == 0) return true;  // nothing to report
+
+  hid_field_t *compiled = (hid_field_t *)arenaAlloc(count * sizeof(hid_field_t));
+  if (!compiled) return false;
+  uint16_t compiled_count;
+  if (!compileDescriptor(compiled, compiled_count) || (compiled_count != count)) {
+    arenaFree(compiled);
+    return false;
+  }
+
+  // Output and Feature fields go in their own table for the report builder
+  uint16_t out_count = 0;
+  for (uint16_t i = 0; i < count; i++) {
+    if (isOutFeatureField(compiled[i])) out_count++;
+  }
+  if (out_count) {
+    out_fields_ = (hid_field_t *)arenaAlloc(out_count * sizeof(hid_field_t));
+    if (!out_fields_) {
+      arenaFree(compiled);
+      return false;
+    }
+    for (uint16_t i = 0; i < count; i++) {
+      if (isOutFeatureField(compiled[i])) out_fields_[out_field_count_++] = compiled[i];
+    }
+  }
+
+  // Which report IDs have Input fields, in the order the descriptor has them
+  uint8_t report_ids[MAX_REPORT_IDS];
+  uint8_t report_id_count = 0;
+  uint16_t end_count = 0;
+  for (uint16_t i = 0; i < count; i++) {
+    if (compiled[i].op == HID_FIELD_END) {
+      end_count++;
+      continue;
+    }
+    if (isOutFeatureField(compiled[i])) continue;
+    uint8_t j;
+    for (j = 0; j < report_id_count; j++) {
+      if (report_ids[j] == compiled[i].report_id) break;
+    }
+    if (j == report_id_count) report_ids[report_id_count++] = compiled[i].report_id;
+  }
+
+  uint32_t total = count - out_count + (uint32_t)report_id_count * end_count;
+  if (total > 0xffff) {
+    arenaFree(compiled);
+    return false;
+  }
+  fields_ = (hid_field_t *)arenaAlloc(total * sizeof(hid_field_t));
+  if (!fields_) {
+    arenaFree(compiled);
+    return false;
+  }
+
+  for (uint8_t span = 0; span <= report_id_count; span++) {
+    spans_[span].first = field_count_;
+    spans_[span].bytes = 0;
+    spans_[span].has_relative = false;
+    for (uint16_t i = 0; i < count; i++) {
+      if ((compiled[i].op == HID_FIELD_END) || (span && (compiled[i].report_id == report_ids[span - 1])
+                                                    && !isOutFeatureField(compiled[i]))) {
+        const hid_field_t &f = compiled[i];
+        uint16_t field_bytes = (f.bit_offset + f.size + 7) / 8;
+        if (field_bytes > spans_[span].bytes) spans_[span].bytes = field_bytes;
+        if (f.flags & HID_FIELD_RELATIVE) spans_[span].has_relative = true;
+
+        // Fold runs of buttons, 1 bit fields with consecutive usages and
+        // bits, into one bitmask field.
+        if ((f.op == HID_FIELD_VARIABLE) && (f.size == 1) && !f.flags && (field_count_ > spans_[span].first)) {
+          hid_field_t &run = fields_[field_count_ - 1];
+          if (((run.op == HID_FIELD_BITMASK) || ((run.op == HID_FIELD_VARIABLE) && (run.size == 1) && !run.flags))
+              && (run.size < 32) && (f.bit_offset == run.bit_offset + run.size) && (f.usage == run.usage + run.size)) {
+            run.op = HID_FIELD_BITMASK;
+            run.size++;
+            continue;
+          }
+        }
+        fields_[field_count_++] = f;
+      }
+    }
+    spans_[span].count = field_count_ - spans_[span].first;
+    if (span) report_span_[report_ids[span - 1]] = span;
+
+    // Now that we know how long the report is, pick how to extract each field
+    for (uint16_t i = spans_[span].first; i < field_count_; i++) {
+      setExtract(fields_[i], spans_[span].bytes);
+    }
+  }
+  span_count_ = report_id_count + 1;
+  arenaFree(compiled);
+
+  DBGPrintf("compileReports: %u report IDs %u fields %u bytes\n", report_id_count, field_count_, field_count_ * sizeof(hid_field_t));
+  return allocReportState();
+}
+
+// The buffers parse() needs, sized from the compiled fields.
+bool USBHostHIDParser::allocReportState() {
+  // Each field gives at most one value or bitmask, one block for all the
+  // arrays and the copy of a short report.
+  uint16_t max_fields = 0;
+  uint16_t max_bytes = 0;
+  for (uint8_t span = 0; span < span_count_; span++) {
+    if (spans_[span].count > max_fields) max_fields = spans_[span].count;
+    if (spans_[span].bytes > max_bytes) max_bytes = spans_[span].bytes;
+  }
+  value_usages_ = (uint32_t *)arenaAlloc(max_fields * (sizeof(uint32_t) * 4 + sizeof(uint16_t) * 2) + max_bytes);
+  if (!value_usages_) return false;
+  values_ = (int32_t *)(value_usages_ + max_fields);
+  bitmasks_ = (uint32_t *)(values_ + max_fields);
+  bitmask_changed_ = bitmasks_ + max_fields;
+  value_fields_ = (uint16_t *)(bitmask_changed_ + max_fields);
+  bitmask_fields_ = value_fields_ + max_fields;
+  report_pad_ = (uint8_t *)(bitmask_fields_ + max_fields);
+
+  if (change_only_) return allocChangeState();
+  return true;
+}
+
+void USBHostHIDParser::freeReports() {
+  if (fields_ != nullptr) {
+    arenaFree(fields_);
+    fields_ = nullptr;
+  }
+  if (out_fields_ != nullptr) {
+    arenaFree(out_fields_);
+    out_fields_ = nullptr;
+  }
+  out_field_count_ = 0;
+  freeChangeState();
+  if (value_usages_ != nullptr) {
+    arenaFree(value_usages_);
+    value_usages_ = nullptr;
+    values_ = nullptr;
+    bitmasks_ = nullptr;
+    bitmask_changed_ = nullptr;
+    value_fields_ = nullptr;
+    bitmask_fields_ = nullptr;
+    report_pad_ = nullptr;
+  }
+  field_count_ = 0;
+  span_count_ = 0;
+  memset(report_span_, 0, sizeof(report_span_));
+}
+
+//=============================================================================
+// Arena: a static block of HID_ARENA_SIZE bytes shared by all parsers.
+// First fit over a list of blocks, free neighbours are merged while
+// looking for room.  The allocations are few, made at connect time, and
+// mostly given back in the order they were made, so this stays compact.
+// When it is full the oldest descriptor cache entries are dropped first.
+//=============================================================================
+uint64_t USBHostHIDParser::s_arena_[ARENA_UNITS];
+uint32_t USBHostHIDParser::s_arena_used_ = 0;
+uint32_t USBHostHIDParser::s_arena_high_water_ = 0;
+uint32_t USBHostHIDParser::s_arena_failures_ = 0;
+rtos::Mutex USBHostHIDParser::s_arena_lock_;
+
+// Host builds with AddressSanitizer (extras/hid_fuzz) still catch overruns
+// between blocks, the headers are left readable.
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#define ARENA_POISON(p, n) ASAN_POISON_MEMORY_REGION(p, n)
+#define ARENA_UNPOISON(p, n) ASAN_UNPOISON_MEMORY_REGION(p, n)
+#else
+#define ARENA_POISON(p, n)
+#define ARENA_UNPOISON(p, n)
+#endif
+
+void *USBHostHIDParser::arenaAlloc(uint32_t size, bool drop_cache) {
+  uint32_t units = 1 + (size + 7) / 8;
+  ScopedArenaLock lock;
+  if (s_arena_[0] == 0) {  // one free block to start with
+    s_arena_[0] = ARENA_UNITS;
+    ARENA_POISON(&s_arena_[1], (ARENA_UNITS - 1) * 8);
+  }
+  for (;;) {
+    uint32_t i = 0;
+    while (i < ARENA_UNITS) {
+      uint32_t block = s_arena_[i] & ~ARENA_USED;
+      if (!(s_arena_[i] & ARENA_USED)) {
+        while ((i + block < ARENA_UNITS) && !(s_arena_[i + block] & ARENA_USED)) block += s_arena_[i + block];
+        s_arena_[i] = block;
+        if (block >= units) {
+          if (block - units >= 2) {
+            ARENA_UNPOISON(&s_arena_[i + units], 8);
+            s_arena_[i + units] = block - units;
+            block = units;
+          }
+          s_arena_[i] = block | ARENA_USED;
+          s_arena_used_ += block * 8;
+          if (s_arena_used_ > s_arena_high_water_) s_arena_high_water_ = s_arena_used_;
+          ARENA_UNPOISON(&s_arena_[i + 1], size);
+          return &s_arena_[i + 1];
+        }
+      }
+      i += block;
+    }
+    if (!drop_cache || !dropOldestCacheEntry()) break;
+  }
+  s_arena_failures_++;
+  DBGPrintf("USBHostHIDParser: arena full, %u bytes wanted\n", size);
+  return nullptr;
+}
+
+void USBHostHIDParser::arenaFree(void *p) {
+  if (p == nullptr) return;
+  uint64_t *header = (uint64_t *)p - 1;
+  ScopedArenaLock lock;
+  uint32_t block = *header & ~ARENA_USED;
+  s_arena_used_ -= block * 8;
+  *header = block;
+  ARENA_POISON(p, (block - 1) * 8);
+}
+
+void USBHostHIDParser::release() {
+  freeReports();
+  if (descriptor_buffer_ != nullptr) {
+    arenaFree(descriptor_buffer_);
+    descriptor_buffer_ = nullptr;
+  }
+  descriptor_length_ = 0;
+}
+
+//=============================================================================
+// Descriptor cache: the raw and compiled descriptors of the last few HID
+// interfaces, so a device that is unplugged and plugged back in does not
+// need the control transfer or the compile again.
+//=============================================================================
+hid_descriptor_cache_t USBHostHIDParser::s_cache_[HID_DESCRIPTOR_CACHE_SIZE];
+uint32_t USBHostHIDParser::s_cache_clock_ = 0;
+uint32_t USBHostHIDParser::s_cache_hits_ = 0;
+uint32_t USBHostHIDParser::s_cache_misses_ = 0;
+
+static uint32_t hid_crc32(uint32_t crc, const uint8_t *data, uint32_t len)
+{
+  crc = ~crc;
+  while (len--) {
+    crc ^= *data++;
+    for (uint8_t i = 0; i < 8; i++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+static uint32_t cacheCRC(const hid_descriptor_cache_t &entry)
+{
+  uint32_t crc = hid_crc32(0, entry.data, entry.descriptor_length
+                           + (entry.field_count + entry.out_field_count) * sizeof(hid_field_t));
+  crc = hid_crc32(crc, (const uint8_t *)entry.spans, entry.span_count * sizeof(hid_report_span_t));
+  return hid_crc32(crc, (const uint8_t *)&entry.use_report_id, 1);
+}
+
+bool USBHostHIDParser::loadFromCache() {
+  uint16_t vid = dev_->getVid();
+  uint16_t pid = dev_->getPid();
+  ScopedArenaLock lock;
+  for (uint8_t i = 0; i < HID_DESCRIPTOR_CACHE_SIZE; i++) {
+    hid_descriptor_cache_t &entry = s_cache_[i];
+    if (!entry.data || (entry.vid != vid) || (entry.pid != pid) || (entry.interface != index_)
+        || (entry.descriptor_length != descriptor_length_)) continue;
+
+    if (cacheCRC(entry) != entry.crc) {
+      DBGPrintf("USBHostHIDParser: cache entry %u bad CRC\n", i);
+      arenaFree(entry.data);
+      entry.data = nullptr;
+      break;
+    }
+    freeReports();
+    // Copied out of the entry, so these must not drop cache entries to fit
+    uint32_t field_bytes = entry.field_count * sizeof(hid_field_t);
+    uint32_t out_field_bytes = entry.out_field_count * sizeof(hid_field_t);
+    descriptor_buffer_ = (uint8_t *)arenaAlloc(descriptor_length_, false);
+    fields_ = (hid_field_t *)arenaAlloc(field_bytes, false);
+    if (!descriptor_buffer_ || !fields_) {
+      release();
+      return false;
+    }
+    memcpy(descriptor_buffer_, entry.data, descriptor_length_);
+    memcpy((void *)fields_, entry.data + descriptor_length_, field_bytes);
+    field_count_ = entry.field_count;
+    if (out_field_bytes) {
+      out_fields_ = (hid_field_t *)arenaAlloc(out_field_bytes, false);
+      if (!out_fields_) {
+        release();
+        return false;
+      }
+      memcpy((void *)out_fields_, entry.data + descriptor_length_ + field_bytes, out_field_bytes);
+      out_field_count_ = entry.out_field_count;
+    }
+    memcpy(spans_, entry.spans, entry.span_count * sizeof(hid_report_span_t));
+    span_count_ = entry.span_count;
+    use_report_id_ = entry.use_report_id;
+    // the report ID of a span is the one its non End Collection fields have
+    for (uint8_t span = 1; span < span_count_; span++) {
+      for (uint16_t i = spans_[span].first; i < spans_[span].first + spans_[span].count; i++) {
+        if (fields_[i].op != HID_FIELD_END) {
+          report_span_[fields_[i].report_id] = span;
+          break;
+        }
+      }
+    }
+    entry.last_used = ++s_cache_clock_;
+    s_cache_hits_++;
+    DBGPrintf("USBHostHIDParser: %04x:%04x intf %u from cache\n", vid, pid, index_);
+    return allocReportState();
+  }
+  s_cache_misses_++;
+  return false;
+}
+
+void USBHostHIDParser::saveToCache() {
+  if (!dev_ || (span_count_ == 0)) return;
+  ScopedArenaLock lock;
+  // Reuse the least recently used entry
+  hid_descriptor_cache_t *entry = &s_cache_[0];
+  for (uint8_t i = 0; i < HID_DESCRIPTOR_CACHE_SIZE; i++) {
+    if (!s_cache_[i].data) {
+      entry = &s_cache_[i];
+      break;
+    }
+    if (s_cache_[i].last_used < entry->last_used) entry = &s_cache_[i];
+  }
+  if (entry->data) arenaFree(entry->data);
+  entry->data = nullptr;
+
+  uint32_t field_bytes = field_count_ * sizeof(hid_field_t);
+  uint32_t out_field_bytes = out_field_count_ * sizeof(hid_field_t);
+  entry->data = (uint8_t *)arenaAlloc(descriptor_length_ + field_bytes + out_field_bytes);
+  if (!entry->data) return;
+  memcpy(entry->data, descriptor_buffer_, descriptor_length_);
+  memcpy(entry->data + descriptor_length_, fields_, field_bytes);
+  if (out_field_bytes) memcpy(entry->data + descriptor_length_ + field_bytes, out_fields_, out_field_bytes);
+  memcpy(entry->spans, spans_, span_count_ * sizeof(hid_report_span_t));
+  entry->vid = dev_->getVid();
+  entry->pid = dev_->getPid();
+  entry->interface = index_;
+  entry->descriptor_length = descriptor_length_;
+  entry->field_count = field_count_;
+  entry->out_field_count = out_field_count_;
+  entry->span_count = span_count_;
+  entry->use_report_id = use_report_id_;
+  entry->last_used = ++s_cache_clock_;
+  entry->crc = cacheCRC(*entry);
+}
+
+// Make room in the arena, returns false when the cache is already empty.
+bool USBHostHIDParser::dropOldestCacheEntry() {
+  hid_descriptor_cache_t *oldest = nullptr;
+  for (uint8_t i = 0; i < HID_DESCRIPTOR_CACHE_SIZE; i++) {
+    if (s_cache_[i].data && (!oldest || (s_cache_[i].last_used < oldest->last_used))) oldest = &s_cache_[i];
+  }
+  if (!oldest) return false;
+  DBGPrintf("USBHostHIDParser: arena full, dropping %04x:%04x from the cache\n", oldest->vid, oldest->pid);
+  arenaFree(oldest->data);
+  oldest->data = nullptr;
+  return true;
+}
+
+void USBHostHIDParser::clearDescriptorCache() {
+  ScopedArenaLock lock;
+  for (uint8_t i = 0; i < HID_DESCRIPTOR_CACHE_SIZE; i++) {
+    if (s_cache_[i].data) arenaFree(s_cache_[i].data);
+    s_cache_[i].data = nullptr;
+  }
+  s_cache_hits_ = 0;
+  s_cache_misses_ = 0;
+}
+
+// Change only delivery: parse() keeps the last report of each report ID,
+// and only calls hid_input_data for the fields whose bits changed.
+// Relative fields (mouse X/Y/wheel...) are deltas, so they are also
+// delivered whenever they are not zero.  If nothing changed at all, no
+// callbacks are made for that report.
+bool USBHostHIDParser::setChangeOnly(bool enable) {
+  change_only_ = enable;
+  if (!enable) {
+    freeChangeState();
+    return true;
+  }
+  return allocChangeState();
+}
+
+// One block: the changed fields bitmask of the current report, the XOR of
+// the current and previous report, then the previous report of each span,
+// all rounded to words.
+bool USBHostHIDParser::allocChangeState() {
+  if ((change_state_ != nullptr) || (span_count_ == 0)) return true;
+  uint32_t max_words = 0;
+  uint32_t max_fields = 0;
+  uint32_t total_words = 0;
+  for (uint8_t span = 0; span < span_count_; span++) {
+    uint32_t words = (spans_[span].bytes + 3) / 4;
+    spans_[span].prev_offset = total_words;
+    total_words += words;
+    if (words > max_words) max_words = words;
+    if (spans_[span].count > max_fields) max_fields = spans_[span].count;
+  }
+  uint32_t mask_words = (max_fields + 31) / 32;
+  change_state_ = (uint32_t *)arenaAlloc((mask_words + max_words + total_words) * sizeof(uint32_t));
+  if (!change_state_) return false;
+  changed_fields_ = change_state_;
+  report_xor_ = changed_fields_ + mask_words;
+  prev_reports_ = report_xor_ + max_words;
+  memset(changed_fields_, 0, mask_words * sizeof(uint32_t));
+  prev_valid_ = 0;
+  return true;
+}
+
+void USBHostHIDParser::freeChangeState() {
+  if (change_state_ != nullptr) {
+    arenaFree(change_state_);
+    change_state_ = nullptr;
+  }
+  changed_fields_ = nullptr;
+  report_xor_ = nullptr;
+  prev_reports_ = nullptr;
+  prev_valid_ = 0;
+}
+
+// XOR the new report with the previous one of this span a word at a time,
+// saving the new one.  Returns false if no bits changed.
+bool USBHostHIDParser::diffReport(uint8_t span_index, const uint8_t *data, uint16_t len) {
+  const hid_report_span_t &span = spans_[span_index];
+  uint32_t *prev = prev_reports_ + span.prev_offset;
+  uint16_t bytes = (len < span.bytes) ? len : span.bytes;
+  uint16_t words = (span.bytes + 3) / 4;
+  uint64_t valid_bit = 1ull << span_index;
+  bool first_report = !(prev_valid_ & valid_bit);
+  uint32_t changed = first_report;
+
+  for (uint16_t i = 0; i < words; i++) {
+    uint32_t w = 0;
+    uint16_t offset = i * 4;
+    if (offset + 4 <= bytes) memcpy(&w, data + offset, 4);
+    else if (offset < bytes) memcpy(&w, data + offset, bytes - offset);
+    // first report, everything is new.
+    report_xor_[i] = (first_report) ? 0xffffffff : (w ^ prev[i]);
+    changed |= report_xor_[i];
+    prev[i] = w;
+  }
+  prev_valid_ |= valid_bit;
+  return changed != 0;
+}
+
+// Unchanged relative fields still have to be sent if they are not zero.
+bool USBHostHIDParser::relativeMoved(const hid_field_t *f, const hid_field_t *end, const uint8_t *data) {
+  for (; f < end; f++) {
+    if ((f->flags & HID_FIELD_RELATIVE) && bitfield(data, f->bit_offset, f->size)) return true;
+  }
+  return false;
+}
+
+const hid_field_t *USBHostHIDParser::reportFields(uint8_t report_id, uint16_t &count) {
+  if (span_count_ == 0) {
+    count = 0;
+    return nullptr;
+  }
+  const hid_report_span_t &span = spans_[report_span_[report_id]];
+  count = span.count;
+  return fields_ + span.first;
+}
+
+void USBHostHIDParser::parse(const uint8_t *data, uint16_t len)
+{
+  uint8_t report_id = 0;
+  if (use_report_id_) {
+    if (len == 0) return;
+    report_id = *data++;
+    len--;
+  }
+
+  DBGPrintf("parse: %p %u: %u %u\n", data, len, use_report_id_, report_id);
+  if (!hidCB_ || !span_count_) return;
+
+  uint8_t span_index = report_span_[report_id];
+  const hid_report_span_t &span = spans_[span_index];
+  const hid_field_t *first = fields_ + span.first;
+  const hid_field_t *end = first + span.count;
+  if (len < span.bytes) {
+    // Short report, work from a zero filled copy so no field reads past
+    // the end of it.
+    if (len) memcpy(report_pad_, data, len);
+    memset(report_pad_ + len, 0, span.bytes - len);
+    data = report_pad_;
+    len = span.bytes;
+  }
+  bool change_only = (change_state_ != nullptr);
+  if (change_only) {
+    if (!diffReport(span_index, data, len) && !(span.has_relative && relativeMoved(first, end, data))) return;
+    memset(changed_fields_, 0, ((span.count + 31) / 32) * sizeof(uint32_t));
+  }
+  bool array_changed = false;
+  uint16_t count = 0;
+  uint16_t bitmask_count = 0;
+
+  for (const hid_field_t *f = first; f < end; f++) {
+    switch (f->op) {
+      case HID_FIELD_VARIABLE:
+        {
+          uint32_t n = extractField(data, f);
+          if (change_only) {
+            if (!fieldChanged((const uint8_t *)report_xor_, f)
+                && !((f->flags & HID_FIELD_RELATIVE) && n)) break;
+            uint16_t index = f - first;
+            changed_fields_[index >> 5] |= 1ul << (index & 31);
+          }
+          value_usages_[count] = f->usage;
+          values_[count] = (f->flags & HID_FIELD_SIGNED) ? signext(n, f->size) : (int32_t)n;
+          value_fields_[count++] = f - first;
+        }
+        break;
+      case HID_FIELD_BITMASK:
+        {
+          uint32_t changed = (f->size < 32) ? ((1ul << f->size) - 1) : 0xffffffff;
+          if (change_only) {
+            changed = extractField((const uint8_t *)report_xor_, f);
+            if (!changed) break;
+            uint16_t index = f - first;
+            changed_fields_[index >> 5] |= 1ul << (index & 31);
+          }
+          bitmask_changed_[bitmask_count] = changed;
+          bitmasks_[bitmask_count] = extractField(data, f);
+          bitmask_fields_[bitmask_count++] = f - first;
+        }
+        break;
+      case HID_FIELD_ARRAY:
+        {
+          if (change_only) {
+            // The entries of an array only mean something together (which
+            // keys are down), so if any of them changed send them all.
+            if ((f == first) || (f[-1].op != HID_FIELD_ARRAY)) {
+              array_changed = false;
+              for (const hid_field_t *af = f; (af < end) && (af->op == HID_FIELD_ARRAY); af++) {
+                if (fieldChanged((const uint8_t *)report_xor_, af)) {
+                  array_changed = true;
+                  break;
+                }
+              }
+            }
+            if (!array_changed) break;
+            uint16_t index = f - first;
+            changed_fields_[index >> 5] |= 1ul << (index & 31);
+          }
+          uint32_t u = extractField(data, f);
+          int n = u;
+          if (n >= f->logical_min && n <= f->logical_max) {
+            value_usages_[count] = f->usage | u;
+            values_[count] = 1;
+            value_fields_[count++] = f - first;
+          }
+        }
+        break;
+    }
+  }
+
+  HIDFieldValues report;
+  report.report_id = report_id;
+  report.count = count;
+  report.usages = value_usages_;
+  report.values = values_;
+  report.field_index = value_fields_;
+  report.bitmask_count = bitmask_count;
+  report.bitmasks = bitmasks_;
+  report.bitmask_changed = bitmask_changed_;
+  report.bitmask_field_index = bitmask_fields_;
+  report.fields = first;
+  report.field_count = span.count;
+  report.data = data;
+  report.length = len;
+  hidCB_->hid_input_report(report);
+}
+
+// Replay a decoded report as the begin/data/end calls, in descriptor order.
+/*virtual*/ void USBHostHIDParserCB::hid_input_report(const HIDFieldValues &report) {
+  uint16_t value = 0;
+  uint16_t bitmask = 0;
+  for (uint16_t i = 0; i < report.field_count; i++) {
+    const hid_field_t &f = report.fields[i];
+    switch (f.op) {
+      case HID_FIELD_END:
+        hid_input_end();
+        break;
+      case HID_FIELD_BEGIN:
+        hid_input_begin(f.usage, f.type, f.logical_min, f.logical_max);
+        break;
+      case HID_FIELD_BITMASK:
+        if ((bitmask < report.bitmask_count) && (report.bitmask_field_index[bitmask] == i)) {
+          // only the buttons that changed, like separate 1 bit fields
+          uint32_t bits = report.bitmasks[bitmask];
+          uint32_t changed = report.bitmask_changed[bitmask++];
+          for (uint8_t b = 0; b < f.size; b++) {
+            if ((changed >> b) & 1) hid_input_data(f.usage + b, (bits >> b) & 1);
+          }
+        }
+        break;
+      default:
+        while ((value < report.count) && (report.field_index[value] == i)) {
+          hid_input_data(report.usages[value], report.values[value]);
+          value++;
+        }
+        break;
+    }
+  }
+}
+
+
+//=============================================================================
+// Output and Feature report builder.  Packs usage/value pairs into a report
+// using the fields the descriptor gave, the caller owns the buffer.
+//=============================================================================
+// Store the low numbits of value into the data array starting at bitindex.
+static void setBitfield(uint8_t *data, uint32_t bitindex, uint32_t numbits, uint64_t value)
+{
+	data += (bitindex >> 3);
+	uint32_t offset = bitindex & 7;
+	while (numbits) {
+		uint32_t bits = 8 - offset;
+		if (bits > numbits) bits = numbits;
+		uint8_t mask = ((1 << bits) - 1) << offset;
+		*data = (*data & ~mask) | ((uint8_t)(value << offset) & mask);
+		value >>= bits;
+		numbits -= bits;
+		offset = 0;
+		data++;
+	}
+}
+
+uint16_t USBHostHIDParser::reportLength(uint8_t type, uint8_t report_id) {
+  for (uint16_t i = 0; i < out_field_count_; i++) {
+    const hid_field_t &f = out_fields_[i];
+    if ((f.op == HID_FIELD_LENGTH) && (f.type == type) && (f.report_id == report_id)) {
+      return (f.bit_offset + 7) / 8 + (use_report_id_ ? 1 : 0);
+    }
+  }
+  return 0;
+}
+
+// Which report of this type has a field with usage
+bool USBHostHIDParser::findReportID(uint8_t type, uint32_t usage, uint8_t &report_id) {
+  for (uint16_t i = 0; i < out_field_count_; i++) {
+    const hid_field_t &f = out_fields_[i];
+    if ((f.type == type) && (f.op != HID_FIELD_LENGTH) && (f.usage == usage)) {
+      report_id = f.report_id;
+      return true;
+    }
+  }
+  return false;
+}
+
+uint16_t USBHostHIDParser::initReport(uint8_t type, uint8_t report_id, uint8_t *buffer, uint16_t size) {
+  uint16_t len = reportLength(type, report_id);
+  if ((len == 0) || (len > size)) return 0;
+  memset(buffer, 0, len);
+  if (use_report_id_) buffer[0] = report_id;
+  return len;
+}
+
+bool USBHostHIDParser::setReportValue(uint8_t type, uint8_t report_id, uint8_t *buffer, uint32_t usage,
+                                      int32_t value, uint8_t index) {
+  uint8_t *data = buffer + (use_report_id_ ? 1 : 0);
+  for (uint16_t i = 0; i < out_field_count_; i++) {
+    const hid_field_t &f = out_fields_[i];
+    if ((f.type != type) || (f.report_id != report_id)) continue;
+    if (f.op == HID_FIELD_VARIABLE) {
+      if ((usage != 0) && (f.usage != usage)) continue;
+      if (index) {
+        index--;
+        continue;
+      }
+      if (f.logical_min <= f.logical_max) {
+        if (value < f.logical_min) value = f.logical_min;
+        else if (value > f.logical_max) value = f.logical_max;
+      }
+      setBitfield(data, f.bit_offset, f.size, (uint64_t)(int64_t)value);
+      return true;
+    }
+    if (f.op == HID_FIELD_ARRAY) {
+      // An array holds the usages that are on, use the first empty slot.
+      int32_t u = usage & 0xffff;
+      if (((f.usage >> 16) != (usage >> 16)) || (u < f.logical_min) || (u > f.logical_max)) continue;
+      if (value == 0) return true;
+      if (bitfield(data, f.bit_offset, f.size) != 0) continue;
+      setBitfield(data, f.bit_offset, f.size, u);
+      return true;
+    }
+  }
+  return false;
+}
+
+uint16_t USBHostHIDParser::buildReport(uint8_t type, uint8_t report_id, const uint32_t *usages, const int32_t *values,
+                                       uint8_t count, uint8_t *buffer, uint16_t size) {
+  uint16_t len = initReport(type, report_id, buffer, size);
+  if (len == 0) return 0;
+  for (uint8_t i = 0; i < count; i++) {
+    // The same usage more than once fills the fields with that usage in order
+    uint8_t index = 0;
+    for (uint8_t j = 0; j < i; j++) {
+      if (usages[j] == usages[i]) index++;
+    }
+    setReportValue(type, report_id, buffer, usages[i], values[i], index);
+  }
+  return len;
 }
 
 bool USBHostHIDParser::getHIDDescriptor() {
 
   //DBGPrintf(">>>>> USBDumperDevice::getHIDDesc(%u) called <<<<< \n", index);
 
-  USB_TYPE res = host_->controlRead(dev_, 0x81, 6, 0x2200, index_, descriptor_buffer_, descriptor_length_);  // get report desc
+  USB_TYPE res = USBHostCapture::controlRead(host_, dev_, 0x81, 6, 0x2200, index_, descriptor_buffer_, descriptor_length_);  // get report desc
 
   if (res != USB_TYPE_OK) {
     DBGPrintf("\t Read HID descriptor failed: %u\n",  res);
@@ -3,18 +3,113 @@
 #include <Arduino.h>
 #include <Arduino_USBHostMbed5.h>
 #include "USBHost/USBHost.h"
+#include "USBHostCapture.h"
+
+// One record of a compiled report descriptor.  init() turns the descriptor
+// into an array of these so parse() does not have to walk it again for
+// every report.
+enum {HID_FIELD_BEGIN = 1, HID_FIELD_VARIABLE, HID_FIELD_ARRAY, HID_FIELD_END, HID_FIELD_BITMASK, HID_FIELD_LENGTH};
+// Report types, the same numbers SET_REPORT/GET_REPORT use in wValue
+enum {HID_REPORT_INPUT = 1, HID_REPORT_OUTPUT = 2, HID_REPORT_FEATURE = 3};
+enum {HID_FIELD_SIGNED = 0x01, HID_FIELD_RELATIVE = 0x02, HID_FIELD_EXTRACT_MASK = 0x70};
+// How parse() gets a field out of the report, in HID_FIELD_EXTRACT_MASK
+enum {HID_EXTRACT_BYTES = 0x00, HID_EXTRACT_U8 = 0x10, HID_EXTRACT_U16 = 0x20, HID_EXTRACT_LOAD32 = 0x30,
+      HID_EXTRACT_LOAD64 = 0x40};
+
+typedef struct {
+  uint8_t op;             // HID_FIELD_xxx
+  uint8_t report_id;
+  uint8_t size;           // bits (up to 64), BITMASK: number of 1 bit buttons
+  uint8_t flags;          // HID_FIELD_SIGNED, HID_FIELD_RELATIVE, HID_EXTRACT_xxx
+  uint16_t bit_offset;    // from the start of the report, after the ID, LENGTH: report bits
+  uint16_t type;          // BEGIN: the Input item flags, others: HID_REPORT_xxx
+  uint32_t usage;         // BEGIN: top usage, ARRAY: usage page << 16, BITMASK: usage of bit 0
+  int32_t logical_min;
+  int32_t logical_max;
+} hid_field_t;
+
+// Everything parse() decoded from one report, usages[i] and values[i] are
+// what hid_input_data would have been called with.  Runs of buttons come
+// as bitmasks instead, bit b of bitmasks[i] is the button with usage
+// fields[bitmask_field_index[i]].usage + b.  In change only mode
+// bitmask_changed[i] has the buttons of the run that changed, otherwise
+// all of them.  fields/field_index say which
+// compiled field each value came from, which the default hid_input_report
+// uses to make the begin/data/end calls.
+struct HIDFieldValues {
+  uint8_t report_id;
+  uint16_t count;
+  const uint32_t *usages;
+  const int32_t *values;
+  const uint16_t *field_index;  // values[i] came from fields[field_index[i]]
+  uint16_t bitmask_count;
+  const uint32_t *bitmasks;
+  const uint32_t *bitmask_changed;
+  const uint16_t *bitmask_field_index;
+  const hid_field_t *fields;
+  uint16_t field_count;
+  const uint8_t *data;          // the report after the report ID, see fieldValue64
+  uint16_t length;
+};
 
 class USBHostHIDParserCB {
 public:
   virtual void hid_input_begin(uint32_t topusage, uint32_t type, int lgmin, int lgmax) {};
-  virtual void hid_input_data(uint32_t usage, int32_t value);
+  virtual void hid_input_data(uint32_t usage, int32_t value) {};
   virtual void hid_input_end() {};
+  // Called once per report.  Override it to get all of the values at once,
+  // the default calls hid_input_begin/data/end like before.
+  virtual void hid_input_report(const HIDFieldValues &report);
 };
 
 
+// The fields one report ID uses, fields_[first] to fields_[first+count-1]
+typedef struct {
+  uint16_t first;
+  uint16_t count;
+  uint16_t bytes;         // report length the fields cover, without the ID
+  uint16_t prev_offset;   // change only: word offset of the previous report
+  bool has_relative;      // any HID_FIELD_RELATIVE fields
+} hid_report_span_t;
+
+// How many HID interfaces to remember the descriptors of, so they are not
+// read and compiled again when the same device is plugged back in.
+#ifndef HID_DESCRIPTOR_CACHE_SIZE
+#define HID_DESCRIPTOR_CACHE_SIZE 4
+#endif
+
+// Bytes of the static arena every parser takes its descriptor, compiled
+// fields and parse buffers from, and the descriptor cache its copies.
+// Nothing comes from the heap, so plugging devices in and out all day
+// does not fragment it.  USBHostHIDParser::arenaHighWater() shows how
+// much the devices you use actually need.
+#ifndef HID_ARENA_SIZE
+#define HID_ARENA_SIZE 32768
+#endif
+
+// Report IDs a descriptor can use, more than this and it is not parsed
+enum { HID_MAX_REPORT_IDS = 32 };
+
+typedef struct {
+  uint16_t vid;
+  uint16_t pid;
+  uint8_t interface;
+  bool use_report_id;
+  uint8_t span_count;
+  uint16_t descriptor_length;
+  uint16_t field_count;
+  uint16_t out_field_count;
+  uint32_t last_used;
+  uint32_t crc;         // of data, spans and use_report_id
+  uint8_t *data;        // the descriptor, the compiled fields, then the Output/Feature fields
+  hid_report_span_t spans[HID_MAX_REPORT_IDS + 1];
+} hid_descriptor_cache_t;
+
 class USBHostHIDParser {
 public:
   bool init(USBHost *host, USBDeviceConnected *dev, uint8_t index, uint16_t len);
+  // Use a report descriptor already in memory, no device needed.
+  bool initFromDescriptor(const uint8_t *descriptor, uint16_t len);
   void parse(const uint8_t *data, uint16_t len);
 
   inline void attach(USBHostHIDParserCB *hidCB) {
@@ -23,15 +118,131 @@ public:
 
 
   bool getHIDDescriptor();
+  uint16_t fieldCount() { return field_count_; }
+  // The full value of a field, for fields wider than 32 bits.  data is the
+  // report after the report ID (HIDFieldValues::data).
+  static uint64_t fieldValue64(const uint8_t *data, const hid_field_t &f);
+  uint8_t reportIDCount() { return span_count_ ? span_count_ - 1 : 0; }
+
+  // Only call hid_input_data for fields that changed since the last report
+  // with the same report ID.
+  bool setChangeOnly(bool enable);
+  bool changeOnly() { return change_only_; }
+  // The fields parse() uses for report_id, in callback order.  In change
+  // only mode, bit i of changedFields() is set when field i of the last
+  // report parsed was delivered.  A run of buttons is one field, see
+  // HIDFieldValues::bitmask_changed for which of them changed.
+  const hid_field_t *reportFields(uint8_t report_id, uint16_t &count);
+  const uint32_t *changedFields() { return changed_fields_; }
+
+  // Build an Output or Feature report (HID_REPORT_xxx) from the descriptor.
+  // initReport clears buffer and puts in the report ID, returning the length
+  // to send or 0 if there is no such report or it does not fit.
+  // setReportValue sets the index'th field with usage (usage 0 matches any
+  // field), values are clamped to the logical range.  buildReport does both
+  // for a list of usages.
+  uint16_t reportLength(uint8_t type, uint8_t report_id);
+  bool findReportID(uint8_t type, uint32_t usage, uint8_t &report_id);
+  uint16_t initReport(uint8_t type, uint8_t report_id, uint8_t *buffer, uint16_t size);
+  bool setReportValue(uint8_t type, uint8_t report_id, uint8_t *buffer, uint32_t usage, int32_t value,
+                      uint8_t index = 0);
+  uint16_t buildReport(uint8_t type, uint8_t report_id, const uint32_t *usages, const int32_t *values,
+                       uint8_t count, uint8_t *buffer, uint16_t size);
+  bool useReportID() { return use_report_id_; }
+
+  // Descriptors remembered from devices seen before, see HID_DESCRIPTOR_CACHE_SIZE
+  static void clearDescriptorCache();
+  static uint32_t descriptorCacheHits() { return s_cache_hits_; }
+  static uint32_t descriptorCacheMisses() { return s_cache_misses_; }
+
+  // Give the descriptor and compiled fields back to the arena, the drivers
+  // call this when their device goes away.
+  void release();
+  ~USBHostHIDParser() { release(); }
+
+  // HID_ARENA_SIZE use in bytes: now, the most ever, and how many
+  // allocations did not fit even after dropping the descriptor cache.
+  static uint32_t arenaUsed() { return s_arena_used_; }
+  static uint32_t arenaHighWater() { return s_arena_high_water_; }
+  static uint32_t arenaFailures() { return s_arena_failures_; }
 
 private:
+  // drop_cache false: fail rather than drop descriptor cache entries
+  static void *arenaAlloc(uint32_t size, bool drop_cache = true);
+  static void arenaFree(void *p);
+  static bool dropOldestCacheEntry();
+  bool setupDescriptor();
+  bool compileReports();
+  bool allocReportState();
+  void freeReports();
+  bool loadFromCache();
+  void saveToCache();
+  uint16_t maxUsagesPerItem();
+  bool compileDescriptor(hid_field_t *fields, uint16_t &count);
+  static void setVariableField(hid_field_t &f, uint8_t report_id, uint16_t bit_offset, uint8_t size,
+                               uint32_t usage, uint8_t flags);
+  static void setExtract(hid_field_t &f, uint16_t report_bytes);
+  static bool isOutFeatureField(const hid_field_t &f) {
+    return (f.op == HID_FIELD_LENGTH) || (((f.op == HID_FIELD_VARIABLE) || (f.op == HID_FIELD_ARRAY))
+                                          && (f.type != HID_REPORT_INPUT));
+  }
+  bool allocChangeState();
+  void freeChangeState();
+  bool diffReport(uint8_t span_index, const uint8_t *data, uint16_t len);
+  static bool relativeMoved(const hid_field_t *f, const hid_field_t *end, const uint8_t *data);
+
   USBHost *host_;
   USBDeviceConnected *dev_ = nullptr;
   uint8_t index_ = 0xff;
   uint8_t *descriptor_buffer_ = nullptr;
   ;
   uint16_t descriptor_length_ = 0;
-  enum { USAGE_LIST_LEN = 24 };
+  // MAX_REPORT_BITS: an 8KB report, MAX_FIELDS: well past any real device
+  enum { MAX_REPORT_IDS = HID_MAX_REPORT_IDS, GLOBAL_STACK_DEPTH = 8, MAX_REPORT_BITS = 0xffff, MAX_FIELDS = 4096 };
+  hid_field_t *fields_ = nullptr;
+  uint16_t field_count_ = 0;
+  hid_field_t *out_fields_ = nullptr;  // Output and Feature fields, plus their report lengths
+  uint16_t out_field_count_ = 0;
+  // spans_[0] only holds the End Collections, for report IDs the
+  // descriptor does not know about.
+  hid_report_span_t spans_[MAX_REPORT_IDS + 1];
+  uint8_t span_count_ = 0;
+  uint8_t report_span_[256];  // report ID -> index into spans_
+
+  static hid_descriptor_cache_t s_cache_[HID_DESCRIPTOR_CACHE_SIZE];
+  static uint32_t s_cache_clock_;
+  static uint32_t s_cache_hits_;
+  static uint32_t s_cache_misses_;
+
+  // Blocks of 8 byte units, each starting with a header unit holding its
+  // length in units (header included), with ARENA_USED set while it is
+  // handed out.  Keeps everything handed out 8 byte aligned.
+  enum { ARENA_UNITS = (HID_ARENA_SIZE + 7) / 8, ARENA_USED = 0x80000000 };
+  static uint64_t s_arena_[ARENA_UNITS];
+  static uint32_t s_arena_used_;
+  static uint32_t s_arena_high_water_;
+  static uint32_t s_arena_failures_;
+  static rtos::Mutex s_arena_lock_;  // the arena and cache, parsers live on more than one thread
+  struct ScopedArenaLock {
+    ScopedArenaLock() { s_arena_lock_.lock(); }
+    ~ScopedArenaLock() { s_arena_lock_.unlock(); }
+  };
+
+  bool change_only_ = false;
+  uint32_t *change_state_ = nullptr;
+  uint32_t *changed_fields_ = nullptr;
+  uint32_t *report_xor_ = nullptr;
+  uint32_t *prev_reports_ = nullptr;
+  uint64_t prev_valid_ = 0;  // bit per span
+
+  // parse() decodes into these, sized for the largest span
+  uint32_t *value_usages_ = nullptr;
+  int32_t *values_ = nullptr;
+  uint32_t *bitmasks_ = nullptr;
+  uint32_t *bitmask_changed_ = nullptr;
+  uint16_t *value_fields_ = nullptr;
+  uint16_t *bitmask_fields_ = nullptr;
+  uint8_t *report_pad_ = nullptr;  // zero filled copy of a short report
 
   USBHostHIDParserCB *hidCB_ = nullptr;  // does this Descriptor have report IDS?
   bool use_report_id_ = false;
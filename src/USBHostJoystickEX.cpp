@@ -119,6 +119,7 @@ void USBHostJoystickEX::init()
     rumble_timeout_ = 0;
     leds_[0] = 0; leds_[1] = 0; leds_[2] = 0;
     buttons = 0;
+    hidParser.release();  // descriptor back to the arena
 }
 
 bool USBHostJoystickEX::connected() {
@@ -163,6 +164,7 @@ bool USBHostJoystickEX::connect()
                 USB_INFO("New Gamepad device: VID:%04x PID:%04x [dev: %p - intf: %d]", dev->getVid(), dev->getPid(), dev, joystick_intf);
                 printf("New Gamepad device: VID:%04x PID:%04x [dev: %p - intf: %d]", dev->getVid(), dev->getPid(), dev, joystick_intf);
                 dev->setName("Gamepad", joystick_intf);
+                USBHOST_CAPTURE_DEVICE(host, dev);
                 host->registerDriver(dev, joystick_intf, this, &USBHostJoystickEX::init);
 
                 int_in->attach(this, &USBHostJoystickEX::rxHandler);
@@ -213,6 +215,7 @@ void USBHostJoystickEX::disconnect() {
 
 void USBHostJoystickEX::rxHandler()
 {
+    USBHOST_CAPTURE_IN(dev, int_in);
     int len = int_in->getLengthTransferred();
     if (len) {
 
@@ -608,6 +611,19 @@ bool USBHostJoystickEX::setLEDs(uint8_t lr, uint8_t lg, uint8_t lb)
 bool USBHostJoystickEX::transmitPS4UserFeedbackMsg()
 {
     uint8_t packet[32];
+    // Output report 5 is one vendor usage per byte, so fill it in by field
+    // index, sized by the descriptor when we have it.
+    uint16_t len = hidParser.initReport(HID_REPORT_OUTPUT, 0x05, packet, sizeof(packet));
+    if (len) {
+        hidParser.setReportValue(HID_REPORT_OUTPUT, 0x05, packet, 0, 0xFF, 0);
+        hidParser.setReportValue(HID_REPORT_OUTPUT, 0x05, packet, 0, rumble_lValue_, 3); // Small Rumble
+        hidParser.setReportValue(HID_REPORT_OUTPUT, 0x05, packet, 0, rumble_rValue_, 4); // Big rumble
+        hidParser.setReportValue(HID_REPORT_OUTPUT, 0x05, packet, 0, leds_[0], 5);       // RGB value
+        hidParser.setReportValue(HID_REPORT_OUTPUT, 0x05, packet, 0, leds_[1], 6);
+        hidParser.setReportValue(HID_REPORT_OUTPUT, 0x05, packet, 0, leds_[2], 7);
+        return sendMessage(packet, len);
+    }
+
     memset(packet, 0, sizeof(packet));
 
     packet[0] = 0x05; // Report ID
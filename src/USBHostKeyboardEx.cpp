@@ -186,6 +186,12 @@ static const keycode_extra_t keycode_extras[] = {
 #define KEY_SCROLL_LOCK (0x47)
 #define KEY_NUM_LOCK (0x53)
 
+enum {LED_FLAG_WAKE = 1};
+
+USBHostKeyboardEx *USBHostKeyboardEx::s_led_list_ = nullptr;
+rtos::Mutex USBHostKeyboardEx::s_led_lock_;
+rtos::Thread *USBHostKeyboardEx::s_led_thread_ = nullptr;
+rtos::EventFlags USBHostKeyboardEx::s_led_flags_;
 
 USBHostKeyboardEx::USBHostKeyboardEx() {
   // Don't reset these each time...
@@ -195,9 +201,15 @@ USBHostKeyboardEx::USBHostKeyboardEx() {
   init();
 }
 
+USBHostKeyboardEx::~USBHostKeyboardEx() {
+  unregisterForLEDS();
+}
+
 
 void USBHostKeyboardEx::init() {
   initHelper();
+  // sendLEDS builds and sends the LED report under led_lock_
+  if (led_registered_) led_lock_.lock();
   dev = NULL;
   int_in = NULL;
   int_extras_in = NULL;
@@ -206,6 +218,14 @@ void USBHostKeyboardEx::init() {
   keyboard_intf = -1;
   keyboard_extras_intf = -1;
   keyboard_device_found = false;
+  report_protocol_ = false;
+  memset(key_state_, 0, sizeof(key_state_));
+  memset(source_key_state_, 0, sizeof(source_key_state_));
+  modifiers_ = 0;
+  leds_pending_ = false;
+  hidParser.release();  // descriptors back to the arena
+  kbdParser.release();
+  if (led_registered_) led_lock_.unlock();
 }
 
 bool USBHostKeyboardEx::connected() {
@@ -245,6 +265,7 @@ bool USBHostKeyboardEx::connect() {
           }
 
           USB_INFO("New Keyboard device: VID:%04x PID:%04x [dev: %p - intf: %d]", dev->getVid(), dev->getPid(), dev, keyboard_intf);
+          USBHOST_CAPTURE_DEVICE(host, dev);
           dev->setName("Keyboard", keyboard_intf);
           host->registerDriver(dev, keyboard_intf, this, &USBHostKeyboardEx::init);
 
@@ -268,7 +289,7 @@ bool USBHostKeyboardEx::connect() {
         if (int_extras_in)host->interruptRead(dev, int_extras_in, buf_extras, size_extras_in_);
 
         // We maybe need to set the device to Idle.
-        host->controlWrite(dev, 0x21, 10, 0, 0, nullptr, 0);  //10=set_IDLE
+        controlWrite(dev, 0x21, 10, 0, 0, nullptr, 0);  //10=set_IDLE
 
         // we might need to set the device into boot mode.
         bool set_boot_mode = force_boot_mode_;
@@ -285,8 +306,16 @@ bool USBHostKeyboardEx::connect() {
           }
         }
         if (set_boot_mode) {
-          host->controlWrite(dev, 0x21, 11, 0, 0, nullptr, 0); // 11=SET_PROTOCOL  BOOT
+          controlWrite(dev, 0x21, 11, 0, 0, nullptr, 0); // 11=SET_PROTOCOL  BOOT
         }
+
+        // In report protocol the input and LED reports are laid out by the
+        // descriptor (N-key rollover bitmaps...), in boot protocol they are
+        // always the 8 byte and 1 byte ones.
+        report_protocol_ = !set_boot_mode && hid_descriptor_size_
+                           && kbdParser.init(host, dev, keyboard_intf, hid_descriptor_size_);
+        kbdParser.attach(this);
+        registerForLEDS();
         
         dev_connected = true;
         return true;
@@ -297,89 +326,144 @@ bool USBHostKeyboardEx::connect() {
   return false;
 }
 
-static bool contains(uint8_t b, const uint8_t *data) {
-  if (data[2] == b || data[3] == b || data[4] == b) return true;
-  if (data[5] == b || data[6] == b || data[7] == b) return true;
-  return false;
-}
-
-
 //=============================================================================
 // rxHandler - called to process input from the primary Interface endpoint
 //=============================================================================
 void USBHostKeyboardEx::rxHandler() {
+  USBHOST_CAPTURE_IN(dev, int_in);
   int len = int_in->getLengthTransferred();
-  //int index = (len == 9) ? 1 : 0;
   int len_listen = int_in->getSize();
-  uint8_t key = 0;
-  if (len == 8 || len == 9) {
+  if (len_listen > (int)sizeof(report)) len_listen = sizeof(report);
+  if (report_protocol_) {
+    parsing_source_ = KEY_SOURCE_KEYBOARD;
+    kbdParser.parse(report, len);
+  } else if (len == 8 || len == 9) {
     // boot format: byte 0 mod, 1=skip, 2-7 keycodes
-    if (memcmp(report, prev_report, len)) {
-      /*
-      Serial.print("USBHostKeyboardEx::rxHandler l:");
-      Serial.print(len, DEC);
-      Serial.print(" ");
-      Serial.println(len_listen, DEC);
-      Serial.print(" = ");
-      for (uint8_t i = 0; i < len; i++) {
-        Serial.print(report[i], HEX);
-        Serial.print(" ");
-      }
-      Serial.println("\n");
-      */
-
-      uint8_t modifier = report[0];
-      modifiers_ = modifier;
-
-      // first check for new key presses
-      for (uint8_t i = 2; i < 8; i++) {
-        uint8_t keycode = report[i];
-        if (keycode == 0) break;  // no more keys pressed
-        if (!contains(keycode, prev_report)) {
-          // new key press
-          keyOEM_ = keycode; 
-          if (onKey) {
-            // This is pretty lame... and buggy
-            key = mapKeycodeToKey(modifier, keycode);
-            //printf("key: %x(%c)\n", key, key);
-            if (key) (*onKey)(key);
-          }
-          if (onKeyCode) (*onKeyCode)(report[i], modifier);
-        }
-      }
-      // next check for releases.
-      for (uint8_t i = 2; i < 8; i++) {
-        uint8_t keycode = prev_report[i];
-        if (keycode == 0) break;  // no more keys pressed
-        if (!contains(keycode, report)) {
-          if (onKeyRelease) {
-            key = mapKeycodeToKey(prev_report[0], prev_report[i]);
-            if (key) (*onKeyRelease)(key);
-          }
-          // See if the user wants to be told about raw keys that are released.
-          if (onKeyCodeRelease) {
-            (*onKeyCodeRelease)(keycode);
-          }
-          // Now see if this is one of the modifier keys
-          if (keycode == KEY_NUM_LOCK) {
-            numLock(!leds_.numLock);
-            // Lets toggle Numlock
-          } else if (keycode == KEY_CAPS_LOCK) {
-            capsLock(!leds_.capsLock);
-
-          } else if (keycode == KEY_SCROLL_LOCK) {
-            scrollLock(!leds_.scrollLock);
-          }
-        }
-      }
-      memcpy(prev_report, report, 8);
+    uint32_t keys[KEY_STATE_WORDS] = {0};
+    static const uint32_t all_keys[KEY_STATE_WORDS] = {0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff,
+                                                      0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff};
+    keys[7] = report[0];  // the modifiers are usages 0xE0-0xE7
+    for (uint8_t i = 2; i < 8; i++) {
+      keys[report[i] >> 5] |= 1ul << (report[i] & 31);
     }
+    updateKeyState(KEY_SOURCE_KEYBOARD, keys, all_keys);
   }
   if (dev && int_in) {
     host->interruptRead(dev, int_in, report, len_listen, false);
   }
 }
 
+//=============================================================================
+// updateKeyState - keys is the state of the keys a report from source
+// covers, the XOR with the previous state gives every press and release
+// at once.
+//=============================================================================
+void USBHostKeyboardEx::updateKeyState(uint8_t source, uint32_t *keys, const uint32_t *covered) {
+  // Usage 1 in every slot is ErrorRollOver, too many keys down for the
+  // report to say which.  Keep the last state until it clears.
+  if (keys[0] & 0x2) return;
+  keys[0] &= ~0xfu;  // 0-3 are not keys
+
+  uint8_t prev_modifiers = modifiers_;
+  uint32_t *source_state = source_key_state_[source];
+  uint32_t changed[KEY_STATE_WORDS];
+  uint32_t any_changed = 0;
+  for (uint8_t w = 0; w < KEY_STATE_WORDS; w++) {
+    source_state[w] = (source_state[w] & ~covered[w]) | keys[w];
+    uint32_t state = source_key_state_[KEY_SOURCE_KEYBOARD][w] | source_key_state_[KEY_SOURCE_EXTRAS][w];
+    changed[w] = state ^ key_state_[w];
+    any_changed |= changed[w];
+    key_state_[w] = state;
+  }
+  if (!any_changed) return;
+  modifiers_ = key_state_[7] & 0xff;
+  changed[7] &= ~0xffu;  // modifiers only show up in getModifiers()
+
+  // presses first, then releases
+  for (uint8_t w = 0; w < KEY_STATE_WORDS; w++) {
+    for (uint32_t bits = changed[w] & key_state_[w]; bits; bits &= bits - 1) {
+      keyPressed(w * 32 + __builtin_ctz(bits));
+    }
+  }
+  for (uint8_t w = 0; w < KEY_STATE_WORDS; w++) {
+    for (uint32_t bits = changed[w] & ~key_state_[w]; bits; bits &= bits - 1) {
+      keyReleased(w * 32 + __builtin_ctz(bits), prev_modifiers);
+    }
+  }
+}
+
+void USBHostKeyboardEx::keyPressed(uint8_t keycode) {
+  keyOEM_ = keycode;
+  keyEvent(0x07, keycode, mapKeycodeToKey(modifiers_, keycode), KEYBOARD_EVENT_PRESS);
+}
+
+void USBHostKeyboardEx::keyReleased(uint8_t keycode, uint8_t modifier) {
+  keyEvent(0x07, keycode, mapKeycodeToKey(modifier, keycode), KEYBOARD_EVENT_RELEASE);
+  // Now see if this is one of the modifier keys
+  if (keycode == KEY_NUM_LOCK) {
+    numLock(!leds_.numLock);
+  } else if (keycode == KEY_CAPS_LOCK) {
+    capsLock(!leds_.capsLock);
+  } else if (keycode == KEY_SCROLL_LOCK) {
+    scrollLock(!leds_.scrollLock);
+  }
+}
+
+//=============================================================================
+// keyEvent - on the USB thread: queue the event for the sketch, or when the
+// queue is not used call the callbacks right away like always.
+//=============================================================================
+void USBHostKeyboardEx::keyEvent(uint16_t page, uint16_t code, uint8_t ascii, uint8_t event) {
+  keyboard_event_t e = {micros(), page, code, modifiers_, ascii, event};
+  if (!event_queue_) {
+    dispatchEvent(e);
+    return;
+  }
+  uint32_t head = event_head_.load(std::memory_order_relaxed);
+  if ((head - event_tail_.load(std::memory_order_acquire)) >= KEYBOARD_EVENT_QUEUE_SIZE) {
+    if (event == KEYBOARD_EVENT_PRESS) dropped_presses_ = dropped_presses_ + 1;
+    else dropped_releases_ = dropped_releases_ + 1;
+    return;
+  }
+  events_[head & (KEYBOARD_EVENT_QUEUE_SIZE - 1)] = e;
+  event_head_.store(head + 1, std::memory_order_release);
+}
+
+bool USBHostKeyboardEx::readEvent(keyboard_event_t &event) {
+  uint32_t tail = event_tail_.load(std::memory_order_relaxed);
+  if (event_head_.load(std::memory_order_acquire) == tail) return false;
+  event = events_[tail & (KEYBOARD_EVENT_QUEUE_SIZE - 1)];
+  event_tail_.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+int USBHostKeyboardEx::processEvents() {
+  keyboard_event_t e;
+  int count = 0;
+  while (readEvent(e)) {
+    dispatchEvent(e);
+    count++;
+  }
+  return count;
+}
+
+void USBHostKeyboardEx::dispatchEvent(const keyboard_event_t &e) {
+  if (e.page != 0x07) {
+    if (e.event == KEYBOARD_EVENT_PRESS) {
+      if (onExtrasPress) (*onExtrasPress)(e.page, e.code);
+    } else {
+      if (onExtrasRelease) (*onExtrasRelease)(e.page, e.code);
+    }
+  } else if (e.event == KEYBOARD_EVENT_PRESS) {
+    if (onKey && e.ascii) (*onKey)(e.ascii);
+    if (onKeyCode) (*onKeyCode)(e.code, e.modifiers);
+  } else {
+    if (onKeyRelease && e.ascii) (*onKeyRelease)(e.ascii);
+    // See if the user wants to be told about raw keys that are released.
+    if (onKeyCodeRelease) (*onKeyCodeRelease)(e.code);
+  }
+}
+
 uint8_t USBHostKeyboardEx::mapKeycodeToKey(uint8_t modifier, uint8_t keycode) {
   // first hack, handle keypad to see if we need to map characters
   for (uint8_t i = 0; i < (sizeof(keycode_numlock) / sizeof(keycode_numlock[0])); i++) {
@@ -410,7 +494,7 @@ uint8_t USBHostKeyboardEx::mapKeycodeToKey(uint8_t modifier, uint8_t keycode) {
   modifier = (modifier | (modifier >> 4)) & 0xf;  // merge left and right modifiers.
   if (((modifier & 0xd) == 0) && leds_.capsLock) modifier ^= 2;  // invert the shift key setting.
   
-  if (keycode <= 0x39) {
+  if (keycode < 0x39) {  // keymap stops before Caps Lock
     if (modifier <= 2) return keymap[modifier][keycode];
     return 0;
   }
@@ -447,19 +531,93 @@ void USBHostKeyboardEx::LEDS(uint8_t leds) {
 
 void USBHostKeyboardEx::updateLEDS() {
   if (host && dev) {
-    Serial.print("$$$ updateLEDS: "); Serial.println(leds_.byte, HEX);
-    USB_TYPE res = host->controlWrite(dev, 0x21, 9, 0x200, 0, (uint8_t *)&leds_.byte, sizeof(leds_.byte));
-    if (res != USB_TYPE_OK) {
-      Serial.print("\tRes: "); Serial.print(res, DEC);
+    leds_pending_ = true;
+    s_led_flags_.set(LED_FLAG_WAKE);
+  }
+}
+
+// Add us to the list the LED thread walks, and start the thread the first
+// time.  The destructor takes us off again.
+void USBHostKeyboardEx::registerForLEDS() {
+  if (led_registered_) return;
+  led_registered_ = true;
+  s_led_lock_.lock();
+  led_next_ = s_led_list_;
+  s_led_list_ = this;
+  s_led_lock_.unlock();
+
+  if (s_led_thread_ == nullptr) {
+    s_led_thread_ = new rtos::Thread(osPriorityNormal, 2 * 1024);
+    if (s_led_thread_) {
+      s_led_thread_->start(mbed::callback(&USBHostKeyboardEx::led_thread_proc));
+    }
+  }
+}
+
+void USBHostKeyboardEx::unregisterForLEDS() {
+  if (!led_registered_) return;
+  s_led_lock_.lock();
+  for (USBHostKeyboardEx **pkbd = &s_led_list_; *pkbd; pkbd = &(*pkbd)->led_next_) {
+    if (*pkbd == this) {
+      *pkbd = led_next_;
+      break;
+    }
+  }
+  s_led_lock_.unlock();
+  led_registered_ = false;
+}
+
+void USBHostKeyboardEx::led_thread_proc() {
+  while(1) {
+    s_led_flags_.wait_any(LED_FLAG_WAKE);
+    // Clear pending before sending, so a change made while the control
+    // transfer is going out sends again.
+    s_led_lock_.lock();
+    for (USBHostKeyboardEx *kbd = s_led_list_; kbd; kbd = kbd->led_next_) {
+      if (kbd->leds_pending_.exchange(false)) kbd->sendLEDS();
     }
+    s_led_lock_.unlock();
   }
 }
 
+void USBHostKeyboardEx::sendLEDS() {
+  if (!host) return;
+  // A disconnect calls init() with the host lock held, so holding it until
+  // the control transfer is done keeps the device from going away under
+  // it, as when the report was sent from the USB thread.
+  USBHost::Lock lock(host);
+  led_lock_.lock();
+  if (!dev) {
+    led_lock_.unlock();
+    return;
+  }
+  uint8_t leds = leds_.byte;
+  // Num Lock, Caps Lock, Scroll Lock, Compose and Kana on the LED page
+  static const uint32_t led_usages[5] = {0x80001, 0x80002, 0x80003, 0x80004, 0x80005};
+  int32_t led_values[5];
+  uint8_t led_report[8];
+  uint8_t led_report_id = 0;
+  uint16_t len = 0;
+  if (report_protocol_ && kbdParser.findReportID(HID_REPORT_OUTPUT, led_usages[0], led_report_id)) {
+    for (uint8_t i = 0; i < 5; i++) led_values[i] = (leds >> i) & 1;
+    len = kbdParser.buildReport(HID_REPORT_OUTPUT, led_report_id, led_usages, led_values, 5, led_report, sizeof(led_report));
+  }
+  if (len == 0) {
+    // boot keyboard layout
+    led_report_id = 0;
+    led_report[0] = leds;
+    len = 1;
+  }
+  controlWrite(dev, 0x21, 9, (HID_REPORT_OUTPUT << 8) | led_report_id, keyboard_intf, led_report, len);
+  led_lock_.unlock();
+}
+
 
 //=============================================================================
 // rxExtrasHandler - called for processing secondary HID interface.
 //=============================================================================
 void USBHostKeyboardEx::rxExtrasHandler() {
+  USBHOST_CAPTURE_IN(dev, int_extras_in);
   int len = int_extras_in->getLengthTransferred();
 
   if (len) {
@@ -475,6 +633,7 @@ void USBHostKeyboardEx::rxExtrasHandler() {
       }
       Serial.println("\n");
       */
+    parsing_source_ = KEY_SOURCE_EXTRAS;
     hidParser.parse(buf_extras, len);
   }
 
@@ -526,6 +685,7 @@ void USBHostKeyboardEx::rxExtrasHandler() {
   if (intf_nb == keyboard_intf) {
     if (type == INTERRUPT_ENDPOINT && dir == IN) {
       keyboard_device_found = true;
+      hid_descriptor_size_ = host->getLengthReportDescr();
       return true;
     }
   }
@@ -540,13 +700,76 @@ void USBHostKeyboardEx::rxExtrasHandler() {
   return false;
 }
 
+// Set count bits starting at key first in a key bitset
+static void setKeyBits(uint32_t *keys, uint8_t first, uint32_t bits, uint8_t count) {
+  if (count < 32) bits &= (1ul << count) - 1;
+  uint8_t shift = first & 31;
+  keys[first >> 5] |= bits << shift;
+  if (shift && ((first >> 5) < USBHostKeyboardEx::KEY_STATE_WORDS - 1)) keys[(first >> 5) + 1] |= bits >> (32 - shift);
+}
+
+//=============================================================================
+// hid_input_report - Keyboard page fields (boot style arrays or N-key
+// rollover bitmaps) go into the key state, anything else (consumer and
+// system keys) through hid_input_data as before.
+//=============================================================================
+/*virtual*/ void USBHostKeyboardEx::hid_input_report(const HIDFieldValues &report) {
+  uint32_t keys[KEY_STATE_WORDS] = {0};
+  uint32_t covered[KEY_STATE_WORDS] = {0};
+  bool has_keys = false;
+  bool has_array = false;
+  bool has_other = false;
+
+  for (uint16_t i = 0; i < report.bitmask_count; i++) {
+    const hid_field_t &f = report.fields[report.bitmask_field_index[i]];
+    if ((f.usage >> 16) != 0x07 || (f.usage & 0xffff) > 0xff) {
+      has_other = true;
+      continue;
+    }
+    setKeyBits(keys, f.usage & 0xff, report.bitmasks[i], f.size);
+    setKeyBits(covered, f.usage & 0xff, 0xffffffff, f.size);
+    has_keys = true;
+  }
+  // An array lists every key that is down, so it covers all of them.  Read
+  // the entries from the report itself: parse() leaves out the ones outside
+  // the logical range (no key) and, in change only mode, unchanged arrays,
+  // so what it emitted can not tell which keys were released.
+  for (uint16_t i = 0; i < report.field_count; i++) {
+    const hid_field_t &f = report.fields[i];
+    if ((f.op != HID_FIELD_ARRAY) || ((f.usage >> 16) != 0x07)) continue;
+    int32_t n = (int32_t)USBHostHIDParser::fieldValue64(report.data, f);
+    if ((n >= f.logical_min) && (n <= f.logical_max) && (n >= 0) && (n <= 0xff)) setKeyBits(keys, n, 1, 1);
+    has_array = true;
+  }
+  if (has_array) {
+    memset(covered, 0xff, sizeof(covered));
+    has_keys = true;
+  }
+  for (uint16_t i = 0; i < report.count; i++) {
+    uint32_t usage = report.usages[i];
+    if ((usage >> 16) != 0x07) {
+      has_other = true;
+      continue;
+    }
+    if (report.fields[report.field_index[i]].op == HID_FIELD_ARRAY) continue;  // done above
+    if ((usage & 0xffff) <= 0xff) {
+      setKeyBits(covered, usage & 0xff, 1, 1);
+      if (report.values[i]) setKeyBits(keys, usage & 0xff, 1, 1);
+    }
+    has_keys = true;
+  }
+  if (has_keys) updateKeyState(parsing_source_, keys, covered);
+  if (has_other) USBHostHIDParserCB::hid_input_report(report);
+}
+
 /*virtual*/ void USBHostKeyboardEx::hid_input_data(uint32_t usage, int32_t value) {
   //printf("hid_input_data(%lx, %ld)\n", usage, value);
+  if ((usage >> 16) == 0x07) return;  // keys, done in hid_input_report
 
   for (uint8_t i = 0; i < count_keys_down_; i++) {
     if (usage == keys_down_[i]) {
       if (value == 0) {
-        if (onExtrasRelease) (*onExtrasRelease)(usage >> 16, usage & 0xff);
+        keyEvent(usage >> 16, usage & 0xffff, 0, KEYBOARD_EVENT_RELEASE);
         count_keys_down_--;
         if (i != count_keys_down_)memmove(&keys_down_[i], &keys_down_[i+1], (count_keys_down_-i) * sizeof(keys_down_[0]));
       }
@@ -556,7 +779,7 @@ void USBHostKeyboardEx::rxExtrasHandler() {
   // Not in list
   if (value && (count_keys_down_ < MAX_KEYS_DOWN)) {
     keys_down_[count_keys_down_++] = usage;
-    if (onExtrasPress) (*onExtrasPress)(usage >> 16, usage & 0xff);
+    keyEvent(usage >> 16, usage & 0xffff, 0, KEYBOARD_EVENT_PRESS);
   }
 }
 
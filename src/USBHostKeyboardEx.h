@@ -22,6 +22,26 @@
 
 #include "USBHost/USBHost.h"
 #include "IUSBEnumeratorEx.h"
+#include <atomic>
+
+// Events the keyboard queues when useEventQueue() is on, must be a power of two
+#ifndef KEYBOARD_EVENT_QUEUE_SIZE
+#define KEYBOARD_EVENT_QUEUE_SIZE 32
+#endif
+
+enum {KEYBOARD_EVENT_RELEASE = 0, KEYBOARD_EVENT_PRESS = 1};
+
+// One key going down or up.  page is 0x07 for keyboard keys, where code is
+// the keycode and ascii what attachPress/attachRelease would get (0 if the
+// key has none), or the HID page of a multimedia/system key (attachHIDPress).
+typedef struct {
+  uint32_t time;        // micros() when the report came in
+  uint16_t page;
+  uint16_t code;
+  uint8_t modifiers;
+  uint8_t ascii;
+  uint8_t event;        // KEYBOARD_EVENT_PRESS or KEYBOARD_EVENT_RELEASE
+} keyboard_event_t;
 
 /**
  * A class to communicate a USB keyboard
@@ -35,6 +55,7 @@ public:
     * Constructor
     */
   USBHostKeyboardEx();
+  ~USBHostKeyboardEx();
 
   /**
      * Try to connect a keyboard device
@@ -146,6 +167,8 @@ public:
   uint8_t LEDS() {
     return leds_.byte;
   }
+  // Queues the LED report, it is sent shortly after from the keyboard LED
+  // thread.  Changes made before it goes out are sent together.
   void updateLEDS(void);
   bool numLock() {
     return leds_.numLock;
@@ -163,6 +186,31 @@ public:
   uint8_t  getModifiers() { return modifiers_; }
   uint8_t  getOemKey() { return keyOEM_; }
 
+  // Every key that is down, from boot reports or N-key rollover bitmaps.
+  // Bit n of the 256 is keyboard usage n, 0xE0-0xE7 are the modifiers.
+  enum {KEY_STATE_WORDS = 8};
+  const uint32_t *keyState() { return key_state_; }
+  bool keyDown(uint8_t keycode) { return key_state_[keycode >> 5] & (1ul << (keycode & 31)); }
+
+  /**
+     * Queue key events instead of calling the attach callbacks from the
+     * USB thread.  The sketch then calls processEvents() from loop() to
+     * have its callbacks called there, or reads the events itself with
+     * readEvent().  Only one thread should read them.
+     *
+     * @param enable true to queue events
+     */
+  void useEventQueue(bool enable = true) { event_queue_ = enable; }
+  int availableEvents() { return (int)(event_head_.load(std::memory_order_acquire) - event_tail_.load(std::memory_order_acquire)); }
+  bool readEvent(keyboard_event_t &event);
+  // Calls the attach callbacks for every queued event, returns how many
+  int processEvents();
+  // Events thrown away because the queue was full.  A lost release leaves
+  // the application thinking a key is still down, keyDown() still knows.
+  uint32_t droppedPresses() { return dropped_presses_; }
+  uint32_t droppedReleases() { return dropped_releases_; }
+  void clearDroppedEvents() { dropped_presses_ = 0; dropped_releases_ = 0; }
+
   // Keyboard special Keys
   enum {KEYD_UP = 0xDA, KEYD_DOWN = 0xD9, KEYD_LEFT = 0xD8, KEYD_RIGHT = 0xD7, KEYD_INSERT = 0xD1, KEYD_DELETE = 0xD4,
         KEYD_PAGE_UP = 0xD3, KEYD_PAGE_DOWN = 0xD6, KEYD_HOME = 0xD2, KEYD_END = 0xD5, KEYD_F1 = 0xC2, KEYD_F2 = 0xC3,
@@ -177,6 +225,7 @@ protected:
   virtual bool useEndpoint(uint8_t intf_nb, ENDPOINT_TYPE type, ENDPOINT_DIRECTION dir);                           //Must return true if the endpoint will be used
 
   // From USBHostHIDParser
+  virtual void hid_input_report(const HIDFieldValues &report);
   virtual void hid_input_data(uint32_t usage, int32_t value);
   virtual void hid_input_end();
 
@@ -188,14 +237,21 @@ private:
   //USBDeviceConnected* dev;
   USBEndpoint* int_in;
   USBEndpoint* int_extras_in;
-  uint8_t report[9];
-  uint8_t prev_report[9];
+  uint8_t report[64];
   uint8_t modifiers_ = 0;
   uint8_t keyOEM_;
 
   uint8_t buf_extras[64];
   uint32_t size_extras_in_;
   uint16_t hid_extras_descriptor_size_;
+  uint16_t hid_descriptor_size_ = 0;
+  bool report_protocol_ = false;  // kbdParser has the keyboard interface descriptor
+  uint32_t key_state_[KEY_STATE_WORDS] = {0};
+  // What each interface says is down, key_state_ is the OR of them.  A
+  // report only replaces the keys of the interface it came from.
+  enum {KEY_SOURCE_KEYBOARD = 0, KEY_SOURCE_EXTRAS, KEY_SOURCE_COUNT};
+  uint32_t source_key_state_[KEY_SOURCE_COUNT][KEY_STATE_WORDS] = {{0}};
+  uint8_t parsing_source_ = KEY_SOURCE_KEYBOARD;  // which parser is calling hid_input_report
 
   int keyboard_intf;
   int keyboard_extras_intf;
@@ -206,6 +262,11 @@ private:
   void rxHandler();
   void rxExtrasHandler();
   uint8_t mapKeycodeToKey(uint8_t modifier, uint8_t keycode);
+  void updateKeyState(uint8_t source, uint32_t *keys, const uint32_t *covered);
+  void keyPressed(uint8_t keycode);
+  void keyReleased(uint8_t keycode, uint8_t modifier);
+  void keyEvent(uint16_t page, uint16_t code, uint8_t ascii, uint8_t event);
+  void dispatchEvent(const keyboard_event_t &event);
 
   void process_hid_data(uint32_t usage, uint32_t value);
 
@@ -219,6 +280,34 @@ private:
   uint32_t keys_down_[MAX_KEYS_DOWN];
   uint8_t count_keys_down_ = 0;
   bool force_boot_mode_ = false;
+
+  // Single producer (the USB thread) single consumer (the sketch) queue,
+  // head and tail are free running counters like SaferRingBufferSpan's.
+  static_assert((KEYBOARD_EVENT_QUEUE_SIZE & (KEYBOARD_EVENT_QUEUE_SIZE - 1)) == 0,
+                "KEYBOARD_EVENT_QUEUE_SIZE should be a power of two");
+  bool event_queue_ = false;
+  keyboard_event_t events_[KEYBOARD_EVENT_QUEUE_SIZE];
+  std::atomic<uint32_t> event_head_{0};
+  std::atomic<uint32_t> event_tail_{0};
+  volatile uint32_t dropped_presses_ = 0;
+  volatile uint32_t dropped_releases_ = 0;
+
+  // LED reports go out from one thread shared by all of the keyboards, so
+  // rxHandler never waits on a control transfer.  updateLEDS() only sets
+  // leds_pending_ and wakes the thread, which sends the current leds_.
+  std::atomic<bool> leds_pending_{false};
+  USBHostKeyboardEx *led_next_ = nullptr;
+  bool led_registered_ = false;
+  rtos::Mutex led_lock_;  // init() resets dev, keyboard_intf and kbdParser while an LED report may be sent; taken after the host lock
+  void registerForLEDS();
+  void unregisterForLEDS();
+  void sendLEDS();
+
+  static USBHostKeyboardEx *s_led_list_;
+  static rtos::Mutex s_led_lock_;  // the list, held while the thread walks it
+  static rtos::Thread *s_led_thread_;
+  static rtos::EventFlags s_led_flags_;
+  static void led_thread_proc();
   uint16_t idVendor_;
   uint16_t idProduct_;
 
@@ -227,6 +316,7 @@ private:
   void init();
 
   USBHostHIDParser hidParser;
+  USBHostHIDParser kbdParser;  // keyboard interface in report protocol: its reports and the LED report
 };
 
 #endif
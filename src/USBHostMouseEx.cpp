@@ -30,6 +30,7 @@ void USBHostMouseEx::init() {
   dev_connected = false;
   mouse_intf = -1;
   mouse_device_found = false;
+  hidParser.release();  // descriptor back to the arena
 }
 
 bool USBHostMouseEx::connected() {
@@ -68,6 +69,7 @@ bool USBHostMouseEx::connect() {
 
           USB_INFO("New Mouse device: VID:%04x PID:%04x [dev: %p - intf: %d]", dev->getVid(), dev->getPid(), dev, mouse_intf);
           dev->setName("Mouse", mouse_intf);
+          USBHOST_CAPTURE_DEVICE(host, dev);
           host->registerDriver(dev, mouse_intf, this, &USBHostMouseEx::init);
 
           int_in->attach(this, &USBHostMouseEx::rxHandler);
@@ -88,6 +90,7 @@ bool USBHostMouseEx::connect() {
 }
 
 void USBHostMouseEx::rxHandler() {
+  USBHOST_CAPTURE_IN(dev, int_in);
   int len = int_in->getLengthTransferred();
 
   if (len) {
@@ -1,6 +1,3 @@
-#include <MemoryHexDump.h>
-#include <GIGA_digitalWriteFast.h>
-
 /* mbed USBHost Library
  * Copyright (c) 2006-2013 ARM Limited
  *
@@ -18,9 +15,19 @@
  */
 
 #include "USBHostSerialDevice.h"
+#include "USBHostTrace.h"
 #include <LibPrintf.h>
 
-enum {LATENCY_TIMEOUT_MSG = 1};
+//#define DEBUG_USBHOST_SERIAL
+
+#ifndef DEBUG_USBHOST_SERIAL
+void inline DBGPrintf(...) {};
+#else
+#define DBGPrintf printf
+#include <MemoryHexDump.h>
+#endif
+
+enum {FLUSH_FLAG_WAKE = 1};
 
 /************************************************************/
 //  Define mapping VID/PID - to Serial Device type.
@@ -44,23 +51,52 @@ USBHostSerialDevice::product_vendor_mapping_t USBHostSerialDevice::pid_vid_mappi
   { 0x10c4, 0xea70, USBHostSerialDevice::CP210X, 0 }
 };
 
-#if 0
-USBHostSerialDevice *USBHostSerialDevice::device_list[MAX_DEVICES] = {nullptr, nullptr};
+USBHostSerialDevice *USBHostSerialDevice::s_flush_list_ = nullptr;
+rtos::Mutex USBHostSerialDevice::s_flush_lock_;
+rtos::Thread *USBHostSerialDevice::s_flush_thread_ = nullptr;
+rtos::EventFlags USBHostSerialDevice::s_flush_flags_;
+mbed::Timeout USBHostSerialDevice::s_flush_timeout_;
+std::atomic<bool> USBHostSerialDevice::s_flush_armed_{false};
+volatile uint32_t USBHostSerialDevice::s_flush_deadline_ = 0;
 
-USBHostSerialDevice::timerCallback USBHostSerialDevice::timerCB_list[MAX_DEVICES] = {&USBHostSerialDevice::txTimerCB0,
-    &USBHostSerialDevice::txTimerCB1};
-#endif
+USBHostSerialDevice::USBHostSerialDevice(bool buffer_writes) : 
+    USBHostSerialDevice(buffer_writes, nullptr, 0, nullptr, 0) {
+}
 
-USBHostSerialDevice::USBHostSerialDevice(bool buffer_writes) : buffer_writes_(buffer_writes) {
+USBHostSerialDevice::USBHostSerialDevice(bool buffer_writes, uint8_t *rx_buffer, uint32_t rx_size,
+                                         uint8_t *tx_buffer, uint32_t tx_size) : 
+    rxBuffer_(nullptr, 0),
+    txBuffer_(nullptr, 0),
+    buffer_writes_(buffer_writes) {
+  // Only allocate the default buffers when the caller did not give us any,
+  // so USBHostSerialDeviceN does not carry them around unused.
+  if (!rx_buffer || !rx_size) {
+    rx_buffer = rx_allocated_ = new uint8_t[DEFAULT_RX_BUFFER_SIZE];
+    rx_size = DEFAULT_RX_BUFFER_SIZE;
+  }
+  if (!tx_buffer || !tx_size) {
+    tx_buffer = tx_allocated_ = new uint8_t[DEFAULT_TX_BUFFER_SIZE];
+    tx_size = DEFAULT_TX_BUFFER_SIZE;
+  }
+  rxBuffer_.setBuffer(rx_buffer, rx_size);
+  txBuffer_.setBuffer(tx_buffer, tx_size);
   host = USBHost::getHostInst();
   init();
 }
 
+USBHostSerialDevice::~USBHostSerialDevice() {
+  unregisterForFlush();
+  delete [] rx_allocated_;
+  delete [] tx_allocated_;
+}
+
 void USBHostSerialDevice::init() {
   dev = NULL;
   bulk_in = NULL;
   bulk_out = NULL;
   int_in = NULL;
+  size_bulk_in_ = 64;   // until connect() reads the endpoints, nothing divides by 0
+  size_bulk_out_ = 64;
   onUpdate = NULL;
   dev_connected = false;
   hser_device_found = false;
@@ -97,7 +133,7 @@ bool USBHostSerialDevice::connect() {
         continue;  //break;  what if multiple devices?
       }
 
-      printf("\tconnect hser_device_found\n\r");
+      DBGPrintf("\tconnect hser_device_found\n\r");
 
       bulk_in = d->getEndpoint(intf_SerialDevice, BULK_ENDPOINT, IN);
       USB_INFO("bulk in:%p", bulk_in);
@@ -109,16 +145,23 @@ bool USBHostSerialDevice::connect() {
       if (bulk_in && bulk_out) {
         dev = d;
         dev_connected = true;
+        USBHOST_CAPTURE_DEVICE(host, dev);
         //        USB_INFO("New hser device: VID:%04x PID:%04x [dev: %p - intf: %d]", dev->getVid(), dev->getPid(), dev, intf_SerialDevice);
         //printf("New hser device: VID:%04x PID:%04x [dev: %p - intf: %d]", dev->getVid(), dev->getPid(), dev, intf_SerialDevice);
         dev->setName("Serial", intf_SerialDevice);
         host->registerDriver(dev, intf_SerialDevice, this, &USBHostSerialDevice::init);
         size_bulk_in_ = bulk_in->getSize();
         size_bulk_out_ = bulk_out->getSize();
+        tx_max_transfer_ = (TX_TRANSFER_SIZE / size_bulk_out_) * size_bulk_out_;
+        if (tx_max_transfer_ == 0) tx_max_transfer_ = TX_TRANSFER_SIZE;
 
         bulk_in->attach(this, &USBHostSerialDevice::rxHandler);
         bulk_out->attach(this, &USBHostSerialDevice::txHandler);
-        host->bulkRead(dev, bulk_in, rxUSBBuf_, size_bulk_in_, false);
+        rx_first_pending_ = 0;
+        rx_next_buffer_ = 0;
+        rx_pending_count_ = 0;
+        rx_stalled_ = false;
+        queueRXRead();
         //printf("\n\r>>>>>>>>>>>>>> connected returning true <<<<<<<<<<<<<<<<<<<<\n\r");
 
         // Each serial type might have their own init sequence required.
@@ -149,29 +192,107 @@ void USBHostSerialDevice::disconnect() {
 
 void USBHostSerialDevice::rxHandler() {
   if (bulk_in) {
+    USBHOST_CAPTURE_IN(dev, bulk_in);
     int len = bulk_in->getLengthTransferred();
+    uint8_t offset = 0;
     //printf("USBHostSerialDevice::rxHandler() called len:%d\n\r", len);
-    //MemoryHexDump(Serial, rxUSBBuf_, len, true);
-    uint8_t *p = rxUSBBuf_; // pointer from input buffer 
     if (sertype_ == FTDI) {
       // We ignore first two bytes on FTDI
       if (len > 2) {
-        p += 2;
+        offset = 2;
         len -= 2;
       } else {
         len = 0;
       }
     }
-    if (len > 0) {
-      rxMut_.lock();
-      for (int i = 0; i < len; i++) {
-        rxBuffer_.store_char(*p++);
+    rx_stats_.packets++;
+    USBHOST_TRACE_EVENT(TRACE_SERIAL_RX_PACKET, len, (rx_queued_ == RX_DIRECT));
+    if (rx_queued_ == RX_DIRECT) {
+      // The read went directly into the ring buffer, the data is already
+      // in place (for FTDI the status bytes landed just before head) so
+      // we only need to publish it.
+      rx_stats_.direct_packets++;
+      if (len > 0) rxBuffer_.advanceHead(len);
+    } else if (len > 0) {
+      rxUSBLen_[rx_queued_] = len;
+      rxUSBOffset_[rx_queued_] = offset;
+      rx_next_buffer_ = (rx_queued_ + 1) % RX_USB_BUFFERS;
+      uint8_t pending = rx_pending_count_.fetch_add(1, std::memory_order_release) + 1;
+      if (pending > rx_stats_.max_pending) rx_stats_.max_pending = pending;
+    }
+
+    // Setup the next read before we copy anything.
+    bool queued = queueRXRead();
+    copyPendingRX();
+    if (!queued && !queueRXRead()) {
+      // All of the packet buffers are full, let the consumer restart us.
+      rx_stats_.pipeline_dry++;
+      USBHOST_TRACE_EVENT(TRACE_SERIAL_RX_DRY, rx_pending_count_.load(), 0);
+      rx_stalled_.store(true, std::memory_order_release);
+    }
+  }
+}
+
+// Queue the next bulk read.  When no packets are waiting and rxBuffer_ has
+// room for a full packet in one piece, the read targets the ring buffer
+// storage directly, otherwise the next free packet buffer.  Returns false
+// if there was no place to put the data.
+bool USBHostSerialDevice::queueRXRead() {
+  uint8_t *rx_buf = nullptr;
+  rx_queued_ = RX_NOT_QUEUED;
+
+  if (rx_pending_count_.load(std::memory_order_acquire) == 0) {
+    ring_regions_t regions;
+    rxBuffer_.writeRegions(regions);
+    if (sertype_ == FTDI) {
+      // FTDI puts two status bytes in front of each packet.  When the buffer
+      // is empty, the two bytes before head have already been consumed, so
+      // start the read there and the data lands exactly at head.
+      if ((rxBuffer_.available() == 0) && ((regions.ptr1 - rxBuffer_._aucBuffer) >= 2)
+          && (((uint32_t)regions.len1 + 2) >= size_bulk_in_)) {
+        rx_buf = regions.ptr1 - 2;
       }
-      rxMut_.unlock();
+    } else if ((uint32_t)regions.len1 >= size_bulk_in_) {
+      rx_buf = regions.ptr1;
     }
+    if (rx_buf) rx_queued_ = RX_DIRECT;
+  }
 
-    // Setup the next read.
-    host->bulkRead(dev, bulk_in, rxUSBBuf_, size_bulk_in_, false);
+  if (!rx_buf) {
+    if (rx_pending_count_.load(std::memory_order_acquire) == RX_USB_BUFFERS) return false;
+    rx_queued_ = rx_next_buffer_;
+    rx_buf = rxUSBBuf_[rx_queued_];
+  }
+  host->bulkRead(dev, bulk_in, rx_buf, size_bulk_in_, false);
+  return true;
+}
+
+// Copy the waiting packets, in order, into the ring buffer as far as
+// they fit.  Both rxHandler and the consumer call this, if the other one
+// is already copying it leaves the rest to them.
+void USBHostSerialDevice::copyPendingRX() {
+  if (rx_copying_.exchange(true, std::memory_order_acquire)) return;
+  while (rx_pending_count_.load(std::memory_order_acquire)) {
+    uint8_t index = rx_first_pending_;
+    int cb = rxBuffer_.write(&rxUSBBuf_[index][rxUSBOffset_[index]], rxUSBLen_[index]);
+    rxUSBOffset_[index] += cb;
+    rxUSBLen_[index] -= cb;
+    if (rxUSBLen_[index]) break;  // ring buffer is full
+    rx_first_pending_ = (index + 1) % RX_USB_BUFFERS;
+    rx_pending_count_.fetch_sub(1, std::memory_order_release);
+  }
+  rx_copying_.store(false, std::memory_order_release);
+}
+
+// Called from the consumer side.  If rxHandler gave up because every
+// buffer was full, no read is outstanding, so we can safely act as the
+// producer to copy what now fits and restart the reads.
+void USBHostSerialDevice::checkRXStalled() {
+  if (rx_stalled_.load(std::memory_order_acquire) && rx_stalled_.exchange(false)) {
+    copyPendingRX();
+    if (!queueRXRead()) {
+      rx_stalled_.store(true, std::memory_order_release);
+    }
   }
 }
 
@@ -179,7 +300,7 @@ void USBHostSerialDevice::rxHandler() {
 /*virtual*/ void USBHostSerialDevice::setVidPid(uint16_t vid, uint16_t pid) {
   // we don't check VID/PID for hser driver
   USB_INFO("VID: %X, PID: %X\n\r", vid, pid);
-  printf("VID: %X, PID: %X", vid, pid);
+  DBGPrintf("VID: %X, PID: %X", vid, pid);
   sertype_ = UNKNOWN;
   for (uint16_t i = 0; i < (sizeof(pid_vid_mapping) / sizeof(pid_vid_mapping[0])); i++) {
     if ((pid_vid_mapping[i].idVendor == vid) && (pid_vid_mapping[i].idProduct == pid)) {
@@ -188,11 +309,11 @@ void USBHostSerialDevice::rxHandler() {
     }
   }
   switch (sertype_) {
-    default: printf(" Unknown\n\r"); break;
-    case FTDI: printf(" FTDI\n\r"); break;
-    case PL2303: printf(" PL2303\n\r"); break;
-    case CH341: printf(" CH341\n\r"); break;
-    case CP210X: printf(" Silex CP210X\n\r"); break;
+    default: DBGPrintf(" Unknown\n\r"); break;
+    case FTDI: DBGPrintf(" FTDI\n\r"); break;
+    case PL2303: DBGPrintf(" PL2303\n\r"); break;
+    case CH341: DBGPrintf(" CH341\n\r"); break;
+    case CP210X: DBGPrintf(" Silex CP210X\n\r"); break;
   }
 }
 
@@ -246,19 +367,19 @@ void USBHostSerialDevice::initCDCACM(bool fConnect) {
   setupdata[4] = (format_ & 0x100)? 2 : 0;  // 0 - 1 stop bit, 1 - 1.5 stop bits, 2 - 2 stop bits
   setupdata[5] = (format_ & 0xe0) >> 5;     // 0 - None, 1 - Odd, 2 - Even, 3 - Mark, 4 - Space
   setupdata[6] = format_ & 0x1f;        // Data bits (5, 6, 7, 8 or 16)
-  host->controlWrite(dev, 0x21, 0x20, 0, 0, setupdata, 7);
+  controlWrite(dev, 0x21, 0x20, 0, 0, setupdata, 7);
 
   // pending & 4
   //println("Control - 0x21,0x22, 0x3");
   // Need to setup  the data the line coding data
-  host->controlWrite(dev, 0x21, 0x22, 3, 0, nullptr, 0);
+  controlWrite(dev, 0x21, 0x22, 3, 0, nullptr, 0);
   dtr_rts_ = 3;
 }
 
 
 void USBHostSerialDevice::initFTDI() {
   // in connect
-  host->controlWrite(dev, 0x40, 0, 0, 0, nullptr, 0); // reset port
+  controlWrite(dev, 0x40, 0, 0, 0, nullptr, 0); // reset port
 
   // & 1  Format
   uint16_t ftdi_format = format_ & 0xf; // This should give us the number of bits.
@@ -266,17 +387,17 @@ void USBHostSerialDevice::initFTDI() {
   ftdi_format |= (format_ & 0xe0) << 3; // they encode bits 9-11
   // See if two stop bits
   if (format_ & 0x100) ftdi_format |= (0x2 << 11);
-  host->controlWrite(dev, 0x40, 4, ftdi_format, 0, nullptr, 0); // data format 8N1
+  controlWrite(dev, 0x40, 4, ftdi_format, 0, nullptr, 0); // data format 8N1
 
   // set baud rate & 2
   uint32_t baudval = 3000000 / baudrate_;
-  host->controlWrite(dev, 0x40, 3, baudval, 0, nullptr, 0);
+  controlWrite(dev, 0x40, 3, baudval, 0, nullptr, 0);
 
   // configure flow control
-  host->controlWrite(dev, 0x40, 2, 0, 1, nullptr, 0);
+  controlWrite(dev, 0x40, 2, 0, 1, nullptr, 0);
 
   // set DTR
-  host->controlWrite(dev, 0x40, 1, 0x0101, 0, nullptr, 0);
+  controlWrite(dev, 0x40, 1, 0x0101, 0, nullptr, 0);
   dtr_rts_ = 1;
 }
 
@@ -284,31 +405,33 @@ void USBHostSerialDevice::initPL2303(bool fConnect) {
   // first part done first time:
   if (fConnect) {
     //printf("Init PL2303 - strange stuff\n\r");
-    host->controlRead(dev, 0xc0, 1, 0x8484, 0, setupdata, 1);  //claim
-    host->controlWrite(dev, 0x40, 1, 0x0404, 0, nullptr, 0); // setup state = 1
-    host->controlRead(dev, 0xc0, 1, 0x8484, 0, setupdata, 1); // 2
-    host->controlRead(dev, 0xc0, 1, 0x8383, 0, setupdata, 1); // 3
+    controlRead(dev, 0xc0, 1, 0x8484, 0, setupdata, 1);  //claim
+    controlWrite(dev, 0x40, 1, 0x0404, 0, nullptr, 0); // setup state = 1
+    controlRead(dev, 0xc0, 1, 0x8484, 0, setupdata, 1); // 2
+    controlRead(dev, 0xc0, 1, 0x8383, 0, setupdata, 1); // 3
     //uint8_t pl2303_v1 = setupdata[0]; // save the first bye of version
 
-    host->controlRead(dev, 0xc0, 1, 0x8484, 0, setupdata, 1); // 4
-    host->controlWrite(dev, 0x40, 1, 0x0404, 1, nullptr, 0); // 5
-    host->controlRead(dev, 0xc0, 1, 0x8484, 0, setupdata, 1); // 6
-    host->controlRead(dev, 0xc0, 1, 0x8383, 0, setupdata, 1); // 7
+    controlRead(dev, 0xc0, 1, 0x8484, 0, setupdata, 1); // 4
+    controlWrite(dev, 0x40, 1, 0x0404, 1, nullptr, 0); // 5
+    controlRead(dev, 0xc0, 1, 0x8484, 0, setupdata, 1); // 6
+    controlRead(dev, 0xc0, 1, 0x8383, 0, setupdata, 1); // 7
     //uint8_t pl2303_v2 = setupdata[0]; // save the first bye of version
     //("PL2303 Version %x : %x\n\r", pl2303_v1, pl2303_v2);
 
-    host->controlWrite(dev, 0x40, 1, 0, 1, nullptr, 0);  // 8
-    host->controlWrite(dev, 0x40, 1, 1, 0, nullptr, 0);  // 9
-    host->controlWrite(dev, 0x40, 1, 2, 0x24, nullptr, 0); // 10
+    controlWrite(dev, 0x40, 1, 0, 1, nullptr, 0);  // 8
+    controlWrite(dev, 0x40, 1, 1, 0, nullptr, 0);  // 9
+    controlWrite(dev, 0x40, 1, 2, 0x24, nullptr, 0); // 10
 
     // USB host shield 2... does not output
-//    host->controlWrite(dev, 0x40, 1, 8, 0, nullptr, 0); // 11
-//    host->controlWrite(dev, 0x40, 1, 9, 0, nullptr, 0); // 12
-//    host->controlRead(dev, 0xA1, 0x21, 0, 0, setupdata, 7); // 13
+//    controlWrite(dev, 0x40, 1, 8, 0, nullptr, 0); // 11
+//    controlWrite(dev, 0x40, 1, 9, 0, nullptr, 0); // 12
+//    controlRead(dev, 0xA1, 0x21, 0, 0, setupdata, 7); // 13
 //  }
   // Now stuff common to connect and begin
 
+  #ifdef DEBUG_USBHOST_SERIAL
   MemoryHexDump(Serial, setupdata, 7, false, "baud/control before\n");
+  #endif
   // pending control bit &2
   setupdata[0] = (baudrate_) & 0xff;  // Setup baud rate 115200 - 0x1C200
   setupdata[1] = (baudrate_ >> 8) & 0xff;
@@ -317,16 +440,20 @@ void USBHostSerialDevice::initPL2303(bool fConnect) {
   setupdata[4] = (format_ & 0x100) ? 2 : 0;  // 0 - 1 stop bit, 1 - 1.5 stop bits, 2 - 2 stop bits
   setupdata[5] = (format_ & 0xe0) >> 5;      // 0 - None, 1 - Odd, 2 - Even, 3 - Mark, 4 - Space
   setupdata[6] = format_ & 0x1f;             // Data bits (5, 6, 7, 8 or 16)
+  #ifdef DEBUG_USBHOST_SERIAL
   MemoryHexDump(Serial, setupdata, 7, false, "baud/control after\n");
-  host->controlWrite(dev, 0x21, 0x20, 0, 0, setupdata, 7);
+  #endif
+  controlWrite(dev, 0x21, 0x20, 0, 0, setupdata, 7);
 
   // pending control 0x4
-  host->controlWrite(dev, 0x40, 1, 0, 0, nullptr, 0);
+  controlWrite(dev, 0x40, 1, 0, 0, nullptr, 0);
 
   // pending control 0x8
   memset(setupdata, 0, sizeof(setupdata));  // clear it to see if we read it...
-  host->controlRead(dev, 0xA1, 0x21, 0, 0, setupdata, 7);
+  controlRead(dev, 0xA1, 0x21, 0, 0, setupdata, 7);
+  #ifdef DEBUG_USBHOST_SERIAL
   MemoryHexDump(Serial, setupdata, 7, false, "baud/control read back\n");
+  #endif
 
   // pending control 0x10
   // This sets the control lines (0x1=DTR, 0x2=RTS)
@@ -338,7 +465,7 @@ void USBHostSerialDevice::initPL2303(bool fConnect) {
   // Only on connect?
 //  if (fConnect) {
 //    printf("PL2303: 0x21, 0x22, 0x3 again\n\r");
-//    host->controlWrite(dev, 0x21, 0x22, 1, 0, nullptr, 0);
+//    controlWrite(dev, 0x21, 0x22, 1, 0, nullptr, 0);
   }
 
 }
@@ -366,32 +493,32 @@ void USBHostSerialDevice::ch341_setBaud() {
   
   //printf("CH341: 40, 0x9a, 0x1312... (Baud word 0):%lx\n\r", factor);
 
-  host->controlWrite(dev, 0x40, 0x9a, 0x1312, factor, setupdata, 0); // 
+  controlWrite(dev, 0x40, 0x9a, 0x1312, factor, setupdata, 0); // 
   
   // output the 2nd byte;
   //printf("CH341: 40, 0x9a, 0x0f2c... (Baud word 1):%x\n\r", factor2);
-  host->controlWrite(dev, 0x40, 0x9a, 0x0f2c, factor2, setupdata, 0); // 
+  controlWrite(dev, 0x40, 0x9a, 0x0f2c, factor2, setupdata, 0); // 
 }
 
 
 
 void USBHostSerialDevice::initCH341(bool fConnect) {
-  printf("initCH341(%u)\n\r", fConnect);
+  DBGPrintf("initCH341(%u)\n\r", fConnect);
 
   // Need to setup  the data the line coding data
   if (fConnect) {
     // & 1...
-    host->controlRead(dev, 0xC0, 0x5f, 0, 0, setupdata, sizeof(setupdata)); 
+    controlRead(dev, 0xC0, 0x5f, 0, 0, setupdata, sizeof(setupdata)); 
     //MemoryHexDump(Serial, setupdata, sizeof(setupdata), true); 
-    host->controlWrite(dev, 0x40, 0xa1, 0, 0, nullptr, 0); // 
+    controlWrite(dev, 0x40, 0xa1, 0, 0, nullptr, 0); // 
     ch341_setBaud(); // send the baud bytes
-    host->controlRead(dev, 0xc0, 0x95, 0x2518, 0, setupdata, sizeof(setupdata)); // 
+    controlRead(dev, 0xc0, 0x95, 0x2518, 0, setupdata, sizeof(setupdata)); // 
     //MemoryHexDump(Serial, setupdata, sizeof(setupdata), true); 
 
-    host->controlWrite(dev, 0x40, 0x9a, 0x2518, 0x0050, nullptr, 0); // 
-    host->controlRead(dev, 0xc0, 0x95, 0x706, 0, setupdata, sizeof(setupdata)); // 
+    controlWrite(dev, 0x40, 0x9a, 0x2518, 0x0050, nullptr, 0); // 
+    controlRead(dev, 0xc0, 0x95, 0x706, 0, setupdata, sizeof(setupdata)); // 
     //MemoryHexDump(Serial, setupdata, sizeof(setupdata), true); 
-    host->controlWrite(dev, 0x40, 0xa1, 0x501f, 0xd90a, nullptr, 0); // 
+    controlWrite(dev, 0x40, 0xa1, 0x501f, 0xd90a, nullptr, 0); // 
   }
   
   // pending & 2 and 4
@@ -407,28 +534,28 @@ void USBHostSerialDevice::initCH341(bool fConnect) {
     case USBHOST_SERIAL_7O1: ch341_format = 0xca; break;
     case USBHOST_SERIAL_8N2: ch341_format = 0xc7; break;
   }
-  host->controlWrite(dev, 0x40, 0x9a, 0x2518, ch341_format, nullptr, 0); // 0x08
+  controlWrite(dev, 0x40, 0x9a, 0x2518, ch341_format, nullptr, 0); // 0x08
 
   // This is setting handshake need to figure out what...
   // 0x20=DTR, 0x40=RTS send ~ of values. 
   //println("CH341: 0x40, 0xa4, 0xff9f, 0, 0 - Handshake");
-  host->controlWrite(dev, 0x40, 0xa4, 0xff9f, 0, nullptr, 0); //  0x10 
+  controlWrite(dev, 0x40, 0xa4, 0xff9f, 0, nullptr, 0); //  0x10 
 
   if (fConnect) {
   // 0x20 
     // This is setting handshake need to figure out what...
     //println("CH341: c0, 95, 0x706, 0, 8 - get status");
-    host->controlRead(dev, 0xc0, 0x95, 0x706, 0, setupdata, sizeof(setupdata)); // 
+    controlRead(dev, 0xc0, 0x95, 0x706, 0, setupdata, sizeof(setupdata)); // 
 
     // This is setting handshake need to figure out what... 0x40
     //println("CH341: c0, 95, 0x706, 0, 8 - get status");
-    host->controlWrite(dev, 0x40, 0x9a, 0x2727, 0, nullptr, 0); // 40
+    controlWrite(dev, 0x40, 0x9a, 0x2727, 0, nullptr, 0); // 40
   }
 }
 
 void USBHostSerialDevice::initCP210X() {
   //printf("CP210X:  0x41, 0x11, 0, 0, 0 - reset port\n\r");
-  host->controlWrite(dev, 0x41, 0x11, 0, 0, nullptr, 0);
+  controlWrite(dev, 0x41, 0x11, 0, 0, nullptr, 0);
 
   // set data format
   uint16_t cp210x_format = (format_ & 0xf) << 8;  // This should give us the number of bits.
@@ -437,7 +564,7 @@ void USBHostSerialDevice::initCP210X() {
   cp210x_format |= (format_ & 0xe0) >> 1;   // they encode bits 9-11
   if (format_ & 0x100) cp210x_format |= 2;  // See if two stop bits
   //printf("CP210x setup, cp210x_format %x\n\r", cp210x_format);
-  host->controlWrite(dev, 0x41, 3, cp210x_format, 0, nullptr, 0);  // data format 8N1
+  controlWrite(dev, 0x41, 3, cp210x_format, 0, nullptr, 0);  // data format 8N1
 
   // set baud rate
   setupdata[0] = (baudrate_)&0xff;  // Setup baud rate 115200 - 0x1C200
@@ -445,15 +572,15 @@ void USBHostSerialDevice::initCP210X() {
   setupdata[2] = (baudrate_ >> 16) & 0xff;
   setupdata[3] = (baudrate_ >> 24) & 0xff;
   //printf("CP210x Set Baud 0x40, 0x1e\n");
-  host->controlWrite(dev, 0x40, 0x1e, 0, 0, setupdata, 4);
+  controlWrite(dev, 0x40, 0x1e, 0, 0, setupdata, 4);
 
   // Appears to be an enable command
   memset(setupdata, 0, sizeof(setupdata));  // clear out the data
-  printf("CP210x 0x41, 0, 1\n\r");
-  host->controlWrite(dev, 0x41, 0, 1, 0, nullptr, 0);
+  DBGPrintf("CP210x 0x41, 0, 1\n\r");
+  controlWrite(dev, 0x41, 0, 1, 0, nullptr, 0);
 
   // MHS_REQUEST
-  host->controlWrite(dev, 0x41, 7, 0x0303, 0, nullptr, 0);
+  controlWrite(dev, 0x41, 7, 0x0303, 0, nullptr, 0);
   //dtr_rts_ = 3;
   return;
 }
@@ -461,21 +588,27 @@ void USBHostSerialDevice::initCP210X() {
 
 
 /*virtual */ int USBHostSerialDevice::available(void) {
+  // Packets that did not fit in rxBuffer_ only get copied by the next
+  // rxHandler, which may never come if the device has nothing more to say.
+  if (rx_pending_count_.load(std::memory_order_acquire)) copyPendingRX();
+  checkRXStalled();
   return rxBuffer_.available();
 }
 /*virtual */ int USBHostSerialDevice::peek(void) {
   return rxBuffer_.peek();
 }
 /*virtual */ int USBHostSerialDevice::read(void) {
-  rxMut_.lock();
-  auto ret = rxBuffer_.read_char();
-  rxMut_.unlock();
+  int ret = rxBuffer_.read_char();
+  if (rx_pending_count_.load(std::memory_order_acquire)) copyPendingRX();
+  checkRXStalled();
   return ret;
 }
 
 /*virtual */ int USBHostSerialDevice::availableForWrite() {
+  if (!dev) return 0;
   if (buffer_writes_) {
-    if (!usb_tx_queued_) {
+    // a free packet buffer will take the next full packet out of txBuffer_
+    if ((tx_staged_ - tx_done_) < TX_USB_BUFFERS) {
       return txBuffer_.availableForStore() + size_bulk_out_;
     }    
     return txBuffer_.availableForStore();
@@ -496,32 +629,40 @@ void USBHostSerialDevice::initCP210X() {
   //printf("USBHostSerialDevice::write(%p, %u)\n\r", buffer, size);
   //MemoryHexDump(Serial, buffer, size, true);
   if (size == 0) return 0; // bail if nothing to do
+  if (!dev) return 0;       // nothing to send it to, and nothing would ever drain txBuffer_
 
   if (buffer_writes_) {
-    stopWriteTimeout(); // turn off the timer.
-    //printf("\tAfter detach TO\n\r");
+    uint32_t now = micros();
+    uint32_t gap_us = now - last_write_us_;
+    last_write_us_ = now;
+    if (adaptive_timeout_) {
+      // running averages, new sample counts 1/4
+      uint32_t gap_sample = (gap_us > adaptive_max_us_) ? adaptive_max_us_ : gap_us;
+      avg_write_gap_us_ = (avg_write_gap_us_ * 3 + gap_sample) / 4;
+      avg_write_size_ = (avg_write_size_ * 3 + size) / 4;
+      if (avg_write_size_ == 0) avg_write_size_ = 1;
+    }
     in_tx_write_ = true; // not sure yet if needed. 
     while (cb_left) {
-      while (!txBuffer_.availableForStore()) {} // should we do something like yield()?
-      //txMut_.lock();
-      txBuffer_.store_char(*buffer++);
-      //txMut_.unlock();
-      cb_left--;
+      // store as much as will fit, spins here while the buffer is full.
+      int cb = txBuffer_.write(buffer, cb_left);
+      buffer += cb;
+      cb_left -= cb;
 
-      if (!usb_tx_queued_ && ((uint32_t)txBuffer_.available() >= size_bulk_out_)) {
+      if (((uint32_t)txBuffer_.available() >= size_bulk_out_) || txBuffer_.isFull()) {
         submit_async_bulk_write(0);
       }
     }
     //printf("\tAfter store loop\n\r");
     in_tx_write_ = false;  
-    if (txBuffer_.available()) {
-      //printf("\tBefore restart timer\n\r");
-      startWriteTimeout();
+    uint32_t cb_pending = txBuffer_.available();
+    if (cb_pending) {
+      setTXDeadline(chooseWriteTimeout(cb_pending, gap_us));
     }
 
   } else {
     while (cb_left) {
-      size_t count_write = (cb_left <= size_bulk_out_)? cb_left : size_bulk_out_;
+      size_t count_write = (cb_left <= tx_max_transfer_)? cb_left : tx_max_transfer_;
 
       USB_TYPE ret;
       //printf("\t%p %p %u\n\r", bulk_out, buffer, count_write);
@@ -537,30 +678,75 @@ void USBHostSerialDevice::initCP210X() {
   return size;
 }
 
+// Move data from txBuffer_ into free packet buffers and put the oldest
+// one on the bus if nothing is there.  Partial packets are only staged
+// for the timeout thread, flush and txHandler during a flush.
 void USBHostSerialDevice::submit_async_bulk_write(uint8_t where_called) {
-  digitalWriteFast(5, HIGH);
-  //txMut_.lock();
-  uint16_t buffer_index = 0;
-  for (; buffer_index < size_bulk_out_; buffer_index++) {
-    digitalWriteFast(4, HIGH);
-    int ch = txBuffer_.read_char();
-    digitalWriteFast(4, LOW);
-    if (ch == -1) break;
-    txUSBBuf_[buffer_index] = ch;
-  }
-  //txMut_.unlock();
-  usb_tx_queued_ = true;
+  if (!dev) return;  // the latency timer can still fire after a disconnect
+  stageTXPackets((where_called >= 2) || in_tx_flush_);
+  startTXTransfer(where_called);
+}
 
-  // Now queue the write.
-  USB_TYPE ret;
-  digitalWriteFast(5, LOW);
-  digitalWriteFast(5, HIGH);
-  if (where_called != 2) printf("submit_async_bulk_write(%u): %p %u\n", where_called, txUSBBuf_, buffer_index);
-  if ((ret = host->bulkWrite(dev, bulk_out, (uint8_t *)txUSBBuf_, buffer_index, false)) != USB_TYPE_PROCESSING) {
-    printf("Async bulkwrite(%p, %u) failed %u\n\r", txUSBBuf_, buffer_index, ret);
+void USBHostSerialDevice::stageTXPackets(bool partial) {
+  // Several threads may get here (write, txHandler, the timeout thread and
+  // flush), only the one that sets tx_staging_ is the consumer of txBuffer_.
+  // A partial request is counted first, so if we lose the claim, the one
+  // holding it sees the request before it lets go.  It stays pending until
+  // a pass gets all of txBuffer_ into the packet buffers, so a tail that
+  // did not fit goes out when txHandler frees one.
+  if (partial) tx_partial_requests_++;
+  for (;;) {
+    if (tx_staging_.exchange(true)) return;
+    uint32_t requests = tx_partial_requests_.load();
+    bool stage_partial = (requests != tx_partial_done_);
+
+    uint32_t staged = tx_staged_.load(std::memory_order_relaxed);
+    while ((staged - tx_done_.load(std::memory_order_acquire)) < TX_USB_BUFFERS) {
+      uint32_t cb = txBuffer_.available();
+      if (cb > tx_max_transfer_) cb = tx_max_transfer_;
+      // whole packets only, unless txBuffer_ is too small to ever hold one
+      else if (!stage_partial && !txBuffer_.isFull()) cb -= cb % size_bulk_out_;
+      if (cb == 0) break;
+
+      uint8_t index = staged % TX_USB_BUFFERS;
+      txUSBLen_[index] = txBuffer_.read(txUSBBuf_[index], cb);
+      tx_stats_.transfers++;
+      if (size_bulk_out_) tx_stats_.packets += (txUSBLen_[index] + size_bulk_out_ - 1) / size_bulk_out_;
+      tx_stats_.bytes += txUSBLen_[index];
+      USBHOST_TRACE_EVENT(TRACE_SERIAL_TX_STAGE, txUSBLen_[index], staged);
+      staged++;
+      tx_staged_.store(staged, std::memory_order_release);
+    }
+    if (stage_partial && !txBuffer_.available()) tx_partial_done_ = requests;
+    tx_staging_ = false;
+    // Go again if a partial request came in while we were staging.
+    if (tx_partial_requests_.load() == requests) return;
   }
-  digitalWriteFast(5, LOW);
+}
+
+void USBHostSerialDevice::startTXTransfer(uint8_t where_called) {
+  while (tx_staged_.load(std::memory_order_acquire) != tx_done_.load(std::memory_order_acquire)) {
+    // Whoever sets usb_tx_queued_ owns the bus side.  If that is someone
+    // else, they will pick up our packet when their transfer completes.
+    if (usb_tx_queued_.exchange(true)) return;
+    uint32_t done = tx_done_.load(std::memory_order_acquire);
+    if (tx_staged_.load(std::memory_order_acquire) == done) {
+      // raced with a completion, release and check again.
+      usb_tx_queued_ = false;
+      continue;
+    }
 
+    uint8_t index = done % TX_USB_BUFFERS;
+    USB_TYPE ret;
+    USBHOST_TRACE_EVENT(TRACE_SERIAL_TX_SUBMIT, txUSBLen_[index], where_called);
+    if ((ret = host->bulkWrite(dev, bulk_out, txUSBBuf_[index], txUSBLen_[index], false)) != USB_TYPE_PROCESSING) {
+      USBHOST_TRACE_EVENT(TRACE_SERIAL_TX_FAIL, txUSBLen_[index], ret);
+      // no completion will come, drop the packet and release the bus.
+      tx_done_.store(done + 1, std::memory_order_release);
+      usb_tx_queued_ = false;
+    }
+    return;
+  }
 }
 
 
@@ -571,68 +757,137 @@ void USBHostSerialDevice::txHandler() {
     // Maybe should check for errors and the like?
    USB_TYPE state = bulk_out->getState();
    if (state == USB_TYPE_IDLE) {
-      int tx_avail = txBuffer_.available(); 
-
-      //printf("txHandler %u %u %d - %d %p\n\r", in_tx_write_, in_tx_flush_, tx_avail,
+      //printf("txHandler %u %u - %d %p\n\r", in_tx_write_, in_tx_flush_,
       //  bulk_out->getLengthTransferred(), bulk_out->getBufStart());
-      usb_tx_queued_ = false; // USB Completed... 
-      if (!in_tx_write_ && tx_avail &&
-        (in_tx_flush_ || ((uint32_t)tx_avail >= size_bulk_out_))) {
-        // if we are not in the write function and there is enough data in the
-        // tx queue to fill the buffer output it now.
-        submit_async_bulk_write(1);
-      }
+      USBHOST_TRACE_EVENT(TRACE_SERIAL_TX_DONE, bulk_out->getLengthTransferred(), 0);
+      // USB Completed, release the packet buffer and the bus.
+      tx_done_.store(tx_done_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+      usb_tx_queued_ = false;
+
+      // The next packet is normally already staged, get it going and
+      // refill the packet buffers with whatever full packets are waiting.
+      startTXTransfer(1);
+      submit_async_bulk_write(1);
     } else {
       //printf("txhandler - state: %u\n\r", state);
     }
   }
 }
 
-#if 0
-// Quick and dirty forwarders
-void USBHostSerialDevice::txTimerCB0() {
-  //printf("USBHostSerialDevice::txTimerCB0() called\n\r");
-  device_list[0]->processTXTimerCB();
+void USBHostSerialDevice::setAdaptiveWriteTimeout(bool enable, uint32_t min_us, uint32_t max_us) {
+  if (max_us < min_us) max_us = min_us;
+  adaptive_min_us_ = min_us;
+  adaptive_max_us_ = max_us;
+  avg_write_gap_us_ = max_us;
+  avg_write_size_ = 1;
+  adaptive_timeout_ = enable;
 }
 
-void USBHostSerialDevice::txTimerCB1() {
-  //printf("USBHostSerialDevice::txTimerCB1() called\n\r");
-  device_list[1]->processTXTimerCB();
+// How long to hold cb_pending bytes hoping to fill the bulk packet.
+uint32_t USBHostSerialDevice::chooseWriteTimeout(uint32_t cb_pending, uint32_t gap_us) {
+  uint32_t timeout_us = write_timeout_;
+  if (adaptive_timeout_ && size_bulk_out_) {
+    uint32_t partial = cb_pending % size_bulk_out_;
+    if ((gap_us >= adaptive_max_us_) || (partial == 0)) {
+      // sparse traffic (or nothing left to fill), get it out quick.
+      timeout_us = adaptive_min_us_;
+    } else {
+      // streaming, allow for the writes needed to fill the packet plus a
+      // half gap of slack.
+      uint32_t writes_needed = (size_bulk_out_ - partial + avg_write_size_ - 1) / avg_write_size_;
+      timeout_us = writes_needed * avg_write_gap_us_ + avg_write_gap_us_ / 2;
+      if (timeout_us < adaptive_min_us_) timeout_us = adaptive_min_us_;
+      else if (timeout_us > adaptive_max_us_) timeout_us = adaptive_max_us_;
+    }
+  }
+  tx_stats_.latency_us = timeout_us;
+  return timeout_us;
 }
-#endif
 
-// Handle the timer interrupt
-void USBHostSerialDevice::processTXTimerCB() {
-  USBHostSerialDevice::message_t * serobj_msg = mail_serobj_event.try_alloc();
-  if (serobj_msg) {
-    serobj_msg->event_id = LATENCY_TIMEOUT_MSG;
-    mail_serobj_event.put(serobj_msg);    
-  } else {
-    startWriteTimeout();
+// Push out the partial packet timeout_us from now.  Only wakes the flush
+// thread when nothing is armed or we need to go before the armed time.
+void USBHostSerialDevice::setTXDeadline(uint32_t timeout_us) {
+  uint32_t deadline = micros() + timeout_us;
+  tx_deadline_ = deadline;
+  tx_deadline_pending_ = true;
+  if (!s_flush_armed_ || ((int32_t)(deadline - s_flush_deadline_) < 0)) {
+    s_flush_flags_.set(FLUSH_FLAG_WAKE);
+  }
+}
+
+// Add us to the list the flush thread walks, and start the thread the
+// first time.  The destructor takes us off again.
+void USBHostSerialDevice::registerForFlush() {
+  if (flush_registered_) return;
+  flush_registered_ = true;
+  s_flush_lock_.lock();
+  flush_next_ = s_flush_list_;
+  s_flush_list_ = this;
+  s_flush_lock_.unlock();
+
+  if (s_flush_thread_ == nullptr) {
+    s_flush_thread_ = new rtos::Thread(osPriorityNormal2, 3 * 1024);
+    if (s_flush_thread_) {
+      s_flush_thread_->start(mbed::callback(&USBHostSerialDevice::flush_thread_proc));
+    }
+  }
+}
+
+void USBHostSerialDevice::unregisterForFlush() {
+  if (!flush_registered_) return;
+  s_flush_lock_.lock();
+  for (USBHostSerialDevice **pser = &s_flush_list_; *pser; pser = &(*pser)->flush_next_) {
+    if (*pser == this) {
+      *pser = flush_next_;
+      break;
+    }
   }
+  s_flush_lock_.unlock();
+  flush_registered_ = false;
 }
 
-#define WAIT_FOR_U32_FOREVER 0xFFFFFFFF
-void USBHostSerialDevice::tx_timeout_thread_proc() {
+// Handle the timer interrupt
+void USBHostSerialDevice::flushTimeoutISR() {
+  s_flush_flags_.set(FLUSH_FLAG_WAKE);
+}
+
+void USBHostSerialDevice::flush_thread_proc() {
   while(1) {
-    osEvent evt = mail_serobj_event.get();
-    if (evt.status == osEventMail) {
-      USBHostSerialDevice::message_t * serobj_msg = (message_t*)evt.value.p;
-      switch (serobj_msg->event_id) {
-        case LATENCY_TIMEOUT_MSG: 
-          {
-
-            if (!usb_tx_queued_ && !in_tx_write_) {
-              stopWriteTimeout(); // stop the timer.
-              submit_async_bulk_write(2); // submit the request for the rest of the data.
-            } else {
-              // maybe we need to reschedule
-              startWriteTimeout();
-            }
-          }
-          break;
+    s_flush_flags_.wait_any(FLUSH_FLAG_WAKE);
+
+    // Clear armed before looking, so a write() that sets its deadline
+    // after we looked at it will wake us again.
+    s_flush_armed_ = false;
+    uint32_t now = micros();
+    bool have_next = false;
+    int32_t next_us = 0;
+    s_flush_lock_.lock();
+    for (USBHostSerialDevice *ser = s_flush_list_; ser; ser = ser->flush_next_) {
+      if (!ser->tx_deadline_pending_) continue;
+      int32_t delta = (int32_t)(ser->tx_deadline_ - now);
+      if (delta <= 0) {
+        if (ser->in_tx_write_) {
+          delta = ser->write_timeout_;  // they will set a new one when done
+        } else {
+          ser->tx_deadline_pending_ = false;
+          USBHOST_TRACE_EVENT(TRACE_SERIAL_TX_TIMEOUT, ser->txBuffer_.available(), 0);
+          ser->tx_stats_.timeout_flushes++;
+          ser->submit_async_bulk_write(2); // stage and submit the rest of the data.
+          continue;
+        }
+      }
+      if (!have_next || (delta < next_us)) {
+        next_us = delta;
+        have_next = true;
       }
-      mail_serobj_event.free(serobj_msg);
+    }
+    s_flush_lock_.unlock();
+    if (have_next) {
+      s_flush_deadline_ = now + next_us;
+      s_flush_timeout_.attach(&USBHostSerialDevice::flushTimeoutISR, std::chrono::microseconds(next_us));
+      s_flush_armed_ = true;
+    } else {
+      s_flush_timeout_.detach();
     }
   }
 }
@@ -640,15 +895,14 @@ void USBHostSerialDevice::tx_timeout_thread_proc() {
 
 /*virtual */ void USBHostSerialDevice::flush(void) {
   if (buffer_writes_) {
-    stopWriteTimeout();
-    // only need to do something if we have a timer running...
+    tx_deadline_pending_ = false;
     in_tx_flush_ = true; 
-    if (!usb_tx_queued_ && txBuffer_.available()) {
-      submit_async_bulk_write(3);
-    }
+    submit_async_bulk_write(3);
 
     // now wait until they all complete...
-    while (usb_tx_queued_) {}
+    while (dev && (usb_tx_queued_ || (tx_staged_ != tx_done_) || txBuffer_.available())) {
+      submit_async_bulk_write(3);
+    }
     in_tx_flush_ = false; 
   }
   // Do we need to ask the serial adapter if they are done or not?
@@ -662,26 +916,10 @@ void USBHostSerialDevice::begin(uint32_t baud, uint32_t format)
   format_ = format;
 
   if (buffer_writes_) {
-    #if 1
-    if (writeTOThread_ == nullptr) {
-      writeTOThread_ = new rtos::Thread(osPriorityNormal2, 3 * 1024);
-      if (writeTOThread_) {
-        writeTOThread_->start(mbed::callback(this, &USBHostSerialDevice::tx_timeout_thread_proc));
-      }
-    }
-    #else
-    // See which slot we have...
-    for (uint8_t i = 0; i < MAX_DEVICES; i++) {
-      if (device_list[i] == this) break; // already in list
-      if (device_list[i] == nullptr) {
-        device_list[i] = this;
-        timerCB_index_ = i;
-      } 
-    }
-    #endif
+    registerForFlush();
   }
-  if (buffer_writes_) printf ("USBHostSerialDevice::begin - buffered writes\n\r");
-  else printf ("USBHostSerialDevice::begin - writes are unbuffered\n\r");
+  if (buffer_writes_) DBGPrintf("USBHostSerialDevice::begin - buffered writes\n\r");
+  else DBGPrintf("USBHostSerialDevice::begin - writes are unbuffered\n\r");
 
   switch (sertype_) {
     default:
@@ -717,13 +955,13 @@ void USBHostSerialDevice::end() {
     default:
     case PL2303:
     case CDCACM:
-      host->controlWrite(dev, 0x21, 0x22, 0, 0, nullptr, 0);
+      controlWrite(dev, 0x21, 0x22, 0, 0, nullptr, 0);
       break;
     case FTDI: 
-      host->controlWrite(dev, 0x40, 1, 0x0100, 0, nullptr, 0);
+      controlWrite(dev, 0x40, 1, 0x0100, 0, nullptr, 0);
       break;  // clear DTR
     case CH341:
-      host->controlWrite(dev, 0x40, 0xa4, 0xffff, 0, nullptr, 0);
+      controlWrite(dev, 0x40, 0xa4, 0xffff, 0, nullptr, 0);
       break;
   }
 
@@ -755,7 +993,7 @@ bool USBHostSerialDevice::cacheStringIndexes() {
   //printf(">>>>> USBHostSerialDevice::cacheStringIndexes() called <<<<< \n\r");
   DeviceDescriptor device_descriptor;
 
-  USB_TYPE res = host->controlRead(  dev,
+  USB_TYPE res = controlRead(  dev,
                          USB_DEVICE_TO_HOST | USB_RECIPIENT_DEVICE,
                          GET_DESCRIPTOR,
                          (DEVICE_DESCRIPTOR << 8) | (0),
@@ -774,7 +1012,7 @@ bool USBHostSerialDevice::cacheStringIndexes() {
   // Now lets try to get the default language ID:
   uint8_t read_buffer[64]; 
   //printf(">>>>> Get Language ID <<<<<<\n\r");
-  res = host->controlRead(  dev,
+  res = controlRead(  dev,
                       USB_DEVICE_TO_HOST | USB_RECIPIENT_DEVICE,
                       GET_DESCRIPTOR,
                       0x300,
@@ -802,7 +1040,7 @@ bool USBHostSerialDevice::getStringDesc(uint8_t index, uint8_t *buffer, size_t l
   uint8_t read_len = len * 2 + 2;
   uint8_t read_buffer[read_len]; // will probably give compiler warning about variable length...
 
-   USB_TYPE res = host->controlRead(  dev,
+   USB_TYPE res = controlRead(  dev,
                       USB_DEVICE_TO_HOST | USB_RECIPIENT_DEVICE,
                       GET_DESCRIPTOR,
                       (STRING_DESCRIPTOR << 8) | (index),
@@ -832,25 +1070,25 @@ bool USBHostSerialDevice::setDTR(bool fSet)
   // NOT sure if we should check pending control and not allow it? OR???
   if (fSet) dtr_rts_ |= 1;
   else dtr_rts_ &= ~1;
-  printf("setDTR: %d %d\n\r", fSet, dtr_rts_);
+  DBGPrintf("setDTR: %d %d\n\r", fSet, dtr_rts_);
 
   switch (sertype_) {
     default: 
       return false; // Not sure how to do...
     case PL2303:
     case CDCACM: 
-      host->controlWrite(dev, 0x21, 0x22, dtr_rts_, 0, nullptr, 0);
+      controlWrite(dev, 0x21, 0x22, dtr_rts_, 0, nullptr, 0);
       break;
     case FTDI: 
-      println("  >>FTDI");
+      DBGPrintf("  >>FTDI\n\r");
       // The high 8 is mask and low 8 is setting. 
-      host->controlWrite(dev, 0x40, 1, fSet? 0x0101 : 0x0100, 0, nullptr, 0);
+      controlWrite(dev, 0x40, 1, fSet? 0x0101 : 0x0100, 0, nullptr, 0);
       break;
     // not sure yet on these  
     //case CH341: 
     case CP210X: 
       // DTR(1) RTS(2)
-      host->controlWrite(dev, 0x41, 7, fSet? 0x0101 : 0x0100, 0, nullptr, 0);
+      controlWrite(dev, 0x41, 7, fSet? 0x0101 : 0x0100, 0, nullptr, 0);
       break;
   }
 
@@ -861,10 +1099,10 @@ bool USBHostSerialDevice::setDTR(bool fSet)
 // Lets split this up from setting both
 bool USBHostSerialDevice::setRTS(bool fSet)
 {
-  printf("setRTS: %d\n\r", fSet);
+  DBGPrintf("setRTS: %d\n\r", fSet);
   if (fSet) dtr_rts_ |= 2;
   else dtr_rts_ &= ~2;
-  printf("setRTS: %d %d\n\r", fSet, dtr_rts_);
+  DBGPrintf("setRTS: %d %d\n\r", fSet, dtr_rts_);
 
   if (!connected()) return false;
   // NOT sure if we should check pending control and not allow it? OR???
@@ -874,18 +1112,18 @@ bool USBHostSerialDevice::setRTS(bool fSet)
       return false; // Not sure how to do...
     case PL2303:
     case CDCACM: 
-      host->controlWrite(dev, 0x21, 0x22, dtr_rts_, 0, nullptr, 0);
+      controlWrite(dev, 0x21, 0x22, dtr_rts_, 0, nullptr, 0);
       break;
     case FTDI: 
-      println("  >>FTDI");
+      DBGPrintf("  >>FTDI\n\r");
       // The high 8 is mask and low 8 is setting. 
-      host->controlWrite(dev, 0x40, 1, fSet? 0x0202 : 0x0200, 0, nullptr, 0);
+      controlWrite(dev, 0x40, 1, fSet? 0x0202 : 0x0200, 0, nullptr, 0);
       break;
     // not sure yet on these  
     //case CH341: 
     case CP210X: 
       // DTR(1) RTS(2)
-      host->controlWrite(dev, 0x41, 7, fSet? 0x0202 : 0x0200, 0, nullptr, 0);
+      controlWrite(dev, 0x41, 7, fSet? 0x0202 : 0x0200, 0, nullptr, 0);
       break;
   }
 
@@ -22,9 +22,29 @@
 #include "USBHost/USBHost.h"
 
 #include "USBHost/USBHostConf.h"
+#include "USBHostCapture.h"
 
 #define ENABLE_BUFFERED_WRITES
 
+// Number of packet buffers that rotate through the bulk IN endpoint.  The
+// next read is queued into a free one before the last packet is copied
+// into the RX ring buffer.
+#ifndef USBHOST_SERIAL_RX_BUFFERS
+#define USBHOST_SERIAL_RX_BUFFERS 2
+#endif
+
+// Number of TX packet buffers, so the next packet can be staged while the
+// previous one is on the bus.
+#ifndef USBHOST_SERIAL_TX_BUFFERS
+#define USBHOST_SERIAL_TX_BUFFERS 2
+#endif
+
+// Largest single bulk OUT transfer.  Leave at 64 (one full speed packet)
+// unless the host stack splits larger transfers into packets.
+#ifndef USBHOST_SERIAL_TX_TRANSFER_SIZE
+#define USBHOST_SERIAL_TX_TRANSFER_SIZE 64
+#endif
+
 // USBSerial formats - Lets encode format into bits
 // Bits: 0-4 - Number of data bits
 // Bits: 5-7 - Parity (0=none, 1=odd, 2 = even)
@@ -45,13 +65,23 @@
  */
 class USBHostSerialDevice : public IUSBEnumerator, public Stream {
 public:
-  enum { DEFAULT_WRITE_TIMEOUT = 3500, MAX_DEVICES = 2};
+  enum { DEFAULT_WRITE_TIMEOUT = 3500, MAX_DEVICES = 2, DEFAULT_RX_BUFFER_SIZE = 128, DEFAULT_TX_BUFFER_SIZE = 128,
+        MIN_ADAPTIVE_WRITE_TIMEOUT = 250};
 
   /**
     * Constructor
     */
   USBHostSerialDevice(bool buffer_writes=false);
 
+  /**
+    * Constructor, using caller supplied storage for the RX and TX buffers.
+    * Sizes are rounded down to a power of two.  A null buffer gets the
+    * default size allocated for that direction.
+    */
+  USBHostSerialDevice(bool buffer_writes, uint8_t *rx_buffer, uint32_t rx_size,
+                      uint8_t *tx_buffer = nullptr, uint32_t tx_size = 0);
+  ~USBHostSerialDevice();
+
   /**
      * Try to connect a hser device
      *
@@ -91,9 +121,44 @@ public:
   virtual size_t write(const uint8_t *buffer, size_t size);
   virtual void flush(void);
 
+  // RX pipeline statistics
+  typedef struct {
+    uint32_t packets;         // bulk IN packets received
+    uint32_t direct_packets;  // ... that landed directly in the ring buffer
+    uint32_t pipeline_dry;    // times no read could be queued, endpoint idle
+    uint8_t max_pending;      // most packet buffers waiting to be copied
+  } rx_stats_t;
+  const rx_stats_t &rxStats() { return rx_stats_; }
+  int rxBufferSize() { return rxBuffer_.size(); }
+  int txBufferSize() { return txBuffer_.size(); }
+  void clearRXStats() { memset(&rx_stats_, 0, sizeof(rx_stats_)); }
+
   uint32_t writeTimeout() {return write_timeout_;}
   void writeTimeOut(uint32_t write_timeout) {write_timeout_ = write_timeout;} // Will not impact current ones.
 
+  // Adaptive latency: when enabled the partial packet timeout is picked per
+  // write() between min_us and max_us.  Sparse writes (command/response)
+  // go out after min_us, a streaming producer gets the time it is expected
+  // to take to fill the rest of the bulk packet.
+  void setAdaptiveWriteTimeout(bool enable, uint32_t min_us = MIN_ADAPTIVE_WRITE_TIMEOUT,
+                               uint32_t max_us = DEFAULT_WRITE_TIMEOUT);
+  bool adaptiveWriteTimeout() { return adaptive_timeout_; }
+
+  // TX statistics
+  typedef struct {
+    uint32_t transfers;       // bulk OUT transfers staged
+    uint32_t packets;         // bulk packets in those transfers
+    uint32_t bytes;           // bytes in those transfers
+    uint32_t timeout_flushes; // partial packets pushed out by the latency timer
+    uint32_t latency_us;      // last latency timeout chosen
+  } tx_stats_t;
+  const tx_stats_t &txStats() { return tx_stats_; }
+  void clearTXStats() { memset(&tx_stats_, 0, sizeof(tx_stats_)); }
+  // percent of the bulk packet space sent that held data
+  uint32_t txFillPercent() {
+    return tx_stats_.packets ? (uint32_t)(((uint64_t)tx_stats_.bytes * 100) / ((uint64_t)tx_stats_.packets * size_bulk_out_)) : 0;
+  }
+
 protected:
   //From IUSBEnumerator
   virtual void setVidPid(uint16_t vid, uint16_t pid);
@@ -138,6 +203,9 @@ private:
 
   void rxHandler();
   void txHandler();
+  bool queueRXRead();
+  void copyPendingRX();
+  void checkRXStalled();
   void (*onUpdate)(uint8_t x, uint8_t y, uint8_t z, uint8_t rz, uint16_t buttons);
   void init();
 
@@ -145,6 +213,13 @@ private:
   bool getStringDesc(uint8_t index, uint8_t *buffer, size_t len);
   bool cacheStringIndexes();
 
+  // control transfers go through here so they can be captured.
+  USB_TYPE controlRead(USBDeviceConnected *dev, uint8_t requestType, uint8_t request, uint32_t value, uint32_t index, uint8_t *buf, uint32_t len) {
+    return USBHostCapture::controlRead(host, dev, requestType, request, value, index, buf, len);
+  }
+  USB_TYPE controlWrite(USBDeviceConnected *dev, uint8_t requestType, uint8_t request, uint32_t value, uint32_t index, uint8_t *buf, uint32_t len) {
+    return USBHostCapture::controlWrite(host, dev, requestType, request, value, index, buf, len);
+  }
 
 
   // The current know serial device types
@@ -165,49 +240,112 @@ private:
 
   sertype_t sertype_ = UNKNOWN;
 
-  // TODO: Maybe replace with a version that is safer...
+  // The ring buffers are single producer/single consumer safe, so no
+  // mutex is needed.  RX: rxHandler produces, the sketch consumes.
+  // TX: write() produces, whoever owns usb_tx_queued_ consumes.
+  // Storage the constructor allocated because none was supplied.
+  uint8_t *rx_allocated_ = nullptr;
+  uint8_t *tx_allocated_ = nullptr;
+
   // RX variables
-  SaferRingBufferN<128> rxBuffer_;
-  rtos::Mutex rxMut_;
-  uint8_t rxUSBBuf_[64];
+  SaferRingBufferSpan rxBuffer_;
+  enum { RX_USB_BUFFERS = USBHOST_SERIAL_RX_BUFFERS, RX_NOT_QUEUED = 0xff, RX_DIRECT = 0xfe };
+  // Packet buffers, used when rxBuffer_ does not have room for a packet.
+  // They are used in order, a packet waits in its buffer until it fits.
+  // rxHandler fills them (rx_next_buffer_ is its), whoever holds
+  // rx_copying_ copies them into rxBuffer_ (rx_first_pending_ is theirs):
+  // rxHandler, or read()/available() when the device has gone quiet.
+  uint8_t rxUSBBuf_[RX_USB_BUFFERS][64];
+  uint8_t rxUSBLen_[RX_USB_BUFFERS];     // bytes still to copy
+  uint8_t rxUSBOffset_[RX_USB_BUFFERS];  // where they start
+  uint8_t rx_first_pending_ = 0;
+  uint8_t rx_next_buffer_ = 0;
+  std::atomic<uint8_t> rx_pending_count_{0};
+  std::atomic<bool> rx_copying_{false};
+  uint8_t rx_queued_ = RX_NOT_QUEUED;    // which buffer the pending read targets
+  // Set by rxHandler when it could not queue a read, the consumer then
+  // takes over the producer side to restart it.
+  std::atomic<bool> rx_stalled_{false};
+  rx_stats_t rx_stats_ = {0, 0, 0, 0};
 
   // TX variables
-  SaferRingBufferN<128> txBuffer_;
-  rtos::Mutex txMut_;
-  uint8_t txUSBBuf_[64];
+  SaferRingBufferSpan txBuffer_;
+  enum { TX_USB_BUFFERS = USBHOST_SERIAL_TX_BUFFERS, TX_TRANSFER_SIZE = USBHOST_SERIAL_TX_TRANSFER_SIZE };
+  // Packet buffers are a small SPSC queue of their own: whoever holds
+  // tx_staging_ fills them from txBuffer_ and bumps tx_staged_, whoever
+  // holds usb_tx_queued_ puts the oldest on the bus and txHandler bumps
+  // tx_done_ when it completes.
+  uint8_t txUSBBuf_[TX_USB_BUFFERS][TX_TRANSFER_SIZE];
+  uint16_t txUSBLen_[TX_USB_BUFFERS];
+  std::atomic<uint32_t> tx_staged_{0};
+  std::atomic<uint32_t> tx_done_{0};
+  std::atomic<bool> tx_staging_{false};
+  // Partial packets asked for (timeout thread, flush) and the last request
+  // whoever held tx_staging_ got all of txBuffer_ out for.  A request made
+  // while someone else is staging is left for them.
+  std::atomic<uint32_t> tx_partial_requests_{0};
+  uint32_t tx_partial_done_ = 0;
+  uint32_t tx_max_transfer_ = 64;  // TX_TRANSFER_SIZE rounded down to whole packets
 
   bool buffer_writes_;
-  mbed::Timeout writeTO_;
-
-    typedef struct {
-        uint8_t event_id;
-        //USBHostSerialDevice *serObj;  
-    } message_t;
-
-  rtos::Thread  *writeTOThread_ = nullptr;
-  rtos::Mail<USBHostSerialDevice::message_t, 10> mail_serobj_event;
 
   uint32_t write_timeout_ = DEFAULT_WRITE_TIMEOUT;
+  bool adaptive_timeout_ = false;
+  uint32_t adaptive_min_us_ = MIN_ADAPTIVE_WRITE_TIMEOUT;
+  uint32_t adaptive_max_us_ = DEFAULT_WRITE_TIMEOUT;
+  uint32_t last_write_us_ = 0;
+  uint32_t avg_write_gap_us_ = 0;   // running averages of the gap between
+  uint32_t avg_write_size_ = 0;     // write() calls and their size
+  uint32_t chooseWriteTimeout(uint32_t cb_pending, uint32_t gap_us);
+  tx_stats_t tx_stats_ = {0, 0, 0, 0, 0};
   volatile uint8_t in_tx_write_ = false;
-  volatile uint8_t usb_tx_queued_ = false;
+  std::atomic<bool> usb_tx_queued_{false};  // a bulk OUT transfer is on the bus
   volatile uint8_t in_tx_flush_ = false;
 
-  // static USBHostSerialDevice *device_list[MAX_DEVICES];
-  //typedef void (*timerCallback)() ;
-  // static timerCallback timerCB_list[MAX_DEVICES];
-  void processTXTimerCB();
-  void tx_timeout_thread_proc();
+  // Latency flush.  One thread and one Timeout are shared by all of the
+  // buffered ports.  write() only updates tx_deadline_, the Timeout is
+  // re-armed only when a port needs an earlier deadline than the one that
+  // is already armed; later deadlines are picked up when it fires.
+  volatile uint32_t tx_deadline_ = 0;        // micros() when partial data goes out
+  std::atomic<bool> tx_deadline_pending_{false};
+  USBHostSerialDevice *flush_next_ = nullptr;
+  bool flush_registered_ = false;
+  void setTXDeadline(uint32_t timeout_us);
+  void registerForFlush();
+  void unregisterForFlush();
+
+  static USBHostSerialDevice *s_flush_list_;
+  static rtos::Mutex s_flush_lock_;  // the list, held while the thread walks it
+  static rtos::Thread *s_flush_thread_;
+  static rtos::EventFlags s_flush_flags_;
+  static mbed::Timeout s_flush_timeout_;
+  static std::atomic<bool> s_flush_armed_;
+  static volatile uint32_t s_flush_deadline_;
+  static void flushTimeoutISR();
+  static void flush_thread_proc();
 
-  uint8_t timerCB_index_ = 0xff;
-  inline void startWriteTimeout() { 
-    writeTO_.attach(mbed::callback(this, &USBHostSerialDevice::processTXTimerCB), std::chrono::microseconds(write_timeout_));}
-  inline void stopWriteTimeout() { writeTO_.detach();}
+  void submit_async_bulk_write(uint8_t where_called);
+  void stageTXPackets(bool partial);
+  void startTXTransfer(uint8_t where_called);
+};
 
 
-//  static void txTimerCB0();
-//  static void txTimerCB1();
+/**
+ * USBHostSerialDevice with the buffer sizes given at compile time, for
+ * example USBHostSerialDeviceN<4096, 256> for a fast GPS or modem port.
+ */
+template <uint32_t RX_SIZE, uint32_t TX_SIZE = USBHostSerialDevice::DEFAULT_TX_BUFFER_SIZE>
+class USBHostSerialDeviceN : public USBHostSerialDevice {
+public:
+  USBHostSerialDeviceN(bool buffer_writes=false) :
+    USBHostSerialDevice(buffer_writes, rx_storage_, RX_SIZE, tx_storage_, TX_SIZE) {}
 
-  void submit_async_bulk_write(uint8_t where_called);
+private:
+  static_assert((RX_SIZE & (RX_SIZE - 1)) == 0, "USBHostSerialDeviceN: RX_SIZE must be a power of two");
+  static_assert((TX_SIZE & (TX_SIZE - 1)) == 0, "USBHostSerialDeviceN: TX_SIZE must be a power of two");
+  static_assert(TX_SIZE >= 64, "USBHostSerialDeviceN: TX_SIZE must hold at least one 64 byte packet");
+  uint8_t rx_storage_[RX_SIZE];
+  uint8_t tx_storage_[TX_SIZE];
 };
 
 #endif
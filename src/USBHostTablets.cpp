@@ -50,6 +50,7 @@ void USBHostTablets::init() {
   int_in = NULL;
   dev_connected = false;
   tablet_intf = -1;
+  hidParser.release();  // descriptor back to the arena
 }
 
 bool USBHostTablets::connected() {
@@ -88,6 +89,7 @@ bool USBHostTablets::connect() {
 
           printf("New Tablet device: VID:%04x PID:%04x [dev: %p - intf: %d]\n", dev->getVid(), dev->getPid(), dev, tablet_intf);
           dev->setName("Tablet", tablet_intf);
+          USBHOST_CAPTURE_DEVICE(host, dev);
           host->registerDriver(dev, tablet_intf, this, &USBHostTablets::init);
 
           int_in->attach(this, &USBHostTablets::rxHandler);
@@ -158,7 +160,7 @@ USB_TYPE USBHostTablets::sendControlWrite(uint32_t bmRequestType, uint32_t bRequ
                                           uint32_t wValue, uint32_t wIndex, uint32_t wLength, void *buf) {
   printf(">>> sendControlWrite(%lx, %lx, %lx %lx, %lx, %p)\n", bmRequestType, bRequest, wValue, wIndex, wLength, buf);
   if (wLength) MemoryHexDump(Serial, (uint8_t *)buf, wLength, false);
-  USB_TYPE res = host->controlWrite(dev, bmRequestType, bRequest, wValue, wIndex, (uint8_t *)buf, wLength);
+  USB_TYPE res = controlWrite(dev, bmRequestType, bRequest, wValue, wIndex, (uint8_t *)buf, wLength);
   if (res != USB_TYPE_OK) printf("\t !! return status: %u = %s\n", res, int_in->getStateString());
   return res;
 }
@@ -166,7 +168,7 @@ USB_TYPE USBHostTablets::sendControlWrite(uint32_t bmRequestType, uint32_t bRequ
 USB_TYPE USBHostTablets::sendControlRead(uint32_t bmRequestType, uint32_t bRequest,
                                          uint32_t wValue, uint32_t wIndex, uint32_t wLength, void *buf) {
   printf(">>> sendControlRead(%lx, %lx, %lx %lx, %lx, %p)\n", bmRequestType, bRequest, wValue, wIndex, wLength, buf);
-  USB_TYPE res = host->controlRead(dev, bmRequestType, bRequest, wValue, wIndex, (uint8_t *)buf, wLength);
+  USB_TYPE res = controlRead(dev, bmRequestType, bRequest, wValue, wIndex, (uint8_t *)buf, wLength);
 
   if (wLength) MemoryHexDump(Serial, (uint8_t *)buf, wLength, false);
   if (res != USB_TYPE_OK) printf("\t !! return status: %u = %s\n", res, int_in->getStateString());
@@ -198,10 +200,20 @@ void USBHostTablets::maybeSendSetupControlPackets() {
     if (s_tablets_info[tablet_info_index_].report_id != 0) {
       if (debugPrint_) printf("$$ Setup tablet report ID: %x to %x\n", s_tablets_info[tablet_info_index_].report_id,
                               s_tablets_info[tablet_info_index_].report_value);
-      static const uint8_t set_report_data[2] = { s_tablets_info[tablet_info_index_].report_id, s_tablets_info[tablet_info_index_].report_value };
+      uint8_t report_id = s_tablets_info[tablet_info_index_].report_id;
+      uint8_t set_report_data[16];
+      // The mode is the first field of the feature report
+      uint16_t len = hidParser.initReport(HID_REPORT_FEATURE, report_id, set_report_data, sizeof(set_report_data));
+      if (len) {
+        hidParser.setReportValue(HID_REPORT_FEATURE, report_id, set_report_data, 0, s_tablets_info[tablet_info_index_].report_value);
+      } else {
+        set_report_data[0] = report_id;
+        set_report_data[1] = s_tablets_info[tablet_info_index_].report_value;
+        len = 2;
+      }
       control_packet_pending_state_ = 0xff;
       control_packet_sent_time = millis();  // remember when we sent it
-      sendControlWrite(0x21, 9, 0x0302, 0, 2, (void *)set_report_data);
+      sendControlWrite(0x21, 9, (HID_REPORT_FEATURE << 8) | report_id, 0, len, (void *)set_report_data);
     }
 
     // required for Huion tablets
@@ -303,6 +315,7 @@ uint32_t USBHostTablets::wacom_equivalent_usage(uint32_t usage) {
 }
 
 void USBHostTablets::rxHandler() {
+  USBHOST_CAPTURE_IN(dev, int_in);
   uint16_t len = int_in->getLengthTransferred();
 
   if (len) {
@@ -0,0 +1,64 @@
+/* USBHost trace support
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "USBHostTrace.h"
+
+#ifdef USBHOST_TRACE
+#include <atomic>
+
+static_assert((USBHOST_TRACE_ENTRIES & (USBHOST_TRACE_ENTRIES - 1)) == 0, "USBHOST_TRACE_ENTRIES must be a power of two");
+
+static usbhost_trace_entry_t s_trace_entries[USBHOST_TRACE_ENTRIES];
+static std::atomic<uint32_t> s_trace_count{0};
+
+static const char *const s_trace_names[] = {
+  "?", "SER RX", "SER RX DRY", "SER TX STAGE", "SER TX SUBMIT", "SER TX FAIL", "SER TX DONE", "SER TX TIMEOUT"
+};
+
+void USBHostTrace::log(uint16_t event, uint16_t arg1, uint32_t arg2) {
+  uint32_t index = s_trace_count.fetch_add(1, std::memory_order_relaxed);
+  usbhost_trace_entry_t *entry = &s_trace_entries[index & (USBHOST_TRACE_ENTRIES - 1)];
+  entry->seq = 0;  // mark as being written
+  entry->time_us = micros();
+  entry->event = event;
+  entry->arg1 = arg1;
+  entry->arg2 = arg2;
+  std::atomic_thread_fence(std::memory_order_release);
+  entry->seq = index + 1;
+}
+
+uint32_t USBHostTrace::count() {
+  return s_trace_count.load(std::memory_order_relaxed);
+}
+
+void USBHostTrace::clear() {
+  s_trace_count = 0;
+  memset(s_trace_entries, 0, sizeof(s_trace_entries));
+}
+
+void USBHostTrace::dump(Print &pr) {
+  uint32_t end = count();
+  uint32_t start = (end > USBHOST_TRACE_ENTRIES) ? end - USBHOST_TRACE_ENTRIES : 0;
+  char line[80];
+  for (uint32_t index = start; index < end; index++) {
+    const usbhost_trace_entry_t *entry = &s_trace_entries[index & (USBHOST_TRACE_ENTRIES - 1)];
+    if (entry->seq != index + 1) continue;  // overwritten or still being written
+    const char *name = (entry->event < (sizeof(s_trace_names) / sizeof(s_trace_names[0]))) ? s_trace_names[entry->event] : "?";
+    snprintf(line, sizeof(line), "%lu %lu: %s %u %lu\n", (unsigned long)index, (unsigned long)entry->time_us,
+             name, entry->arg1, (unsigned long)entry->arg2);
+    pr.print(line);
+  }
+}
+#endif
@@ -0,0 +1,69 @@
+/* USBHost trace support
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __USBHOSTTRACE_H__
+#define __USBHOSTTRACE_H__
+#include <Arduino.h>
+
+// Uncomment to record trace events from the driver hot paths.  When it is
+// not defined USBHOST_TRACE_EVENT compiles to nothing.
+//#define USBHOST_TRACE
+
+// Trace event ids
+enum {
+  TRACE_SERIAL_RX_PACKET = 1,  // arg1: length, arg2: 1 if it landed in the ring buffer
+  TRACE_SERIAL_RX_DRY,         // arg1: packets waiting
+  TRACE_SERIAL_TX_STAGE,       // arg1: length, arg2: packet number
+  TRACE_SERIAL_TX_SUBMIT,      // arg1: length, arg2: where called
+  TRACE_SERIAL_TX_FAIL,        // arg1: length, arg2: USB_TYPE returned
+  TRACE_SERIAL_TX_DONE,        // arg1: length transferred
+  TRACE_SERIAL_TX_TIMEOUT,     // arg1: bytes in the TX buffer
+};
+
+#ifdef USBHOST_TRACE
+
+#ifndef USBHOST_TRACE_ENTRIES
+#define USBHOST_TRACE_ENTRIES 256  // must be a power of two
+#endif
+
+typedef struct {
+  volatile uint32_t seq;  // event number + 1, written last
+  uint32_t time_us;
+  uint16_t event;
+  uint16_t arg1;
+  uint32_t arg2;
+} usbhost_trace_entry_t;
+
+// A fixed size binary event log.  log() can be called from any thread, it
+// only claims a slot with an atomic increment, so it never blocks.  When
+// the log wraps the oldest entries are overwritten.
+class USBHostTrace {
+public:
+  static void log(uint16_t event, uint16_t arg1, uint32_t arg2);
+  static uint32_t count();
+  static void clear();
+
+  // Print the entries still in the log, not meant to be called while
+  // the drivers are busy.
+  static void dump(Print &pr);
+};
+
+#define USBHOST_TRACE_EVENT(event, arg1, arg2) USBHostTrace::log((event), (arg1), (arg2))
+
+#else
+#define USBHOST_TRACE_EVENT(event, arg1, arg2) ((void)0)
+#endif
+
+#endif